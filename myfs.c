@@ -12,190 +12,5167 @@
 #include <linux/uaccess.h>
 #include <linux/fs_context.h>
 #include <linux/fs_parser.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/rwsem.h>
+#include <linux/cgroup.h>
+#include <linux/hashtable.h>
+#include <linux/math64.h>
+#include <linux/file.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/sort.h>
+#include <linux/fsnotify.h>
+#include <linux/falloc.h>
+#include <linux/fcntl.h>
+#include <linux/unicode.h>
+#include <linux/fileattr.h>
+#include <linux/xattr.h>
+#include <linux/security.h>
+#include <linux/hash.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/idr.h>
+#include <linux/fadvise.h>
+#include <linux/cpuset.h>
+#include <linux/workqueue.h>
+#include <linux/overflow.h>
+#include <linux/percpu_counter.h>
+#include <linux/rmap.h>
+#include <linux/jump_label.h>
+#include <linux/llist.h>
+
+#include "myfs.h"
+
+#define CREATE_TRACE_POINTS
+#include "myfs_trace.h"
 
 extern const struct inode_operations myfs_file_inode_operations;
 
-static unsigned long myfs_mmu_get_unmapped_area(struct file *file,
-		unsigned long addr, unsigned long len, unsigned long pgoff,
-		unsigned long flags)
+struct myfs_mount_opts {
+	umode_t mode;
+	bool casefold;
+	bool lru;			/* cache=lru */
+	unsigned long max_pages;	/* size=, 0 for no limit */
+	bool cluster;
+};
+
+/* utf8 tables used for casefolded directories */
+#define MYFS_UTF8_VERSION	UNICODE_AGE(12, 1, 0)
+
+/*
+ * Lock classes myfs accounts contention for.  The directory i_rwsem is
+ * taken by the VFS before it calls into us, so for MYFS_LOCK_DIR we can
+ * only see that somebody queued up behind us while we held it; the time
+ * recorded is how long we held it, not a wait.  MYFS_LOCK_MAPPING covers
+ * page cache insertion (mapping xa_lock plus page allocation), which is
+ * "contended" when it takes longer than MYFS_LOCK_SLOW_NS.  Times, and
+ * so mapping contention, are only taken while lock timing is on.
+ */
+enum myfs_lock_class {
+	MYFS_LOCK_DIR,
+	MYFS_LOCK_FILE,
+	MYFS_LOCK_MAPPING,
+	MYFS_LOCK_NR,
+};
+
+#define MYFS_LOCK_SLOW_NS	(50 * NSEC_PER_USEC)
+
+/* Page pools for write-lifetime hints, see myfs_grab_page() */
+#define MYFS_POOL_ORDER	(MAX_ORDER > 9 ? 9 : MAX_ORDER - 1)
+
+enum myfs_pool_class {
+	MYFS_POOL_SHORT,	/* WRITE_LIFE_SHORT, WRITE_LIFE_MEDIUM */
+	MYFS_POOL_LONG,		/* WRITE_LIFE_LONG, WRITE_LIFE_EXTREME */
+	MYFS_POOL_NR,
+};
+
+struct myfs_page_pool {
+	spinlock_t lock;
+	struct page *block;		/* split; pages from next on are free */
+	unsigned int next, left;
+	u64 blocks, pages, fallbacks;
+};
+
+/* TTL timer wheel geometry, see myfs_ttl_slot() */
+#define MYFS_TTL_BITS	6
+#define MYFS_TTL_SLOTS	(1 << MYFS_TTL_BITS)
+#define MYFS_TTL_LEVELS	4
+#define MYFS_TTL_MAX	((1LL << (MYFS_TTL_BITS * MYFS_TTL_LEVELS)) - 1)
+#define MYFS_TTL_BATCH	128
+
+struct myfs_lock_stat {
+	u64 acquired[MYFS_LOCK_NR];
+	u64 contended[MYFS_LOCK_NR];
+	u64 time_ns[MYFS_LOCK_NR];	/* contended wait, or hold for DIR */
+};
+
+struct myfs_fs_info {
+	struct myfs_mount_opts mount_opts;
+	struct myfs_lock_stat __percpu *lock_stat;
+	struct dentry *debugfs;
+	struct super_block *sb;
+	DECLARE_HASHTABLE(qos_rules, 6);	/* struct myfs_qos_rule by cgroup id */
+	unsigned int qos_nr_rules;
+	struct mutex qos_mutex;		/* serialises rule updates */
+	wait_queue_head_t commit_wq;	/* lookups waiting for a commit */
+	spinlock_t ttl_lock;		/* TTL wheel and counters */
+	struct list_head ttl_wheel[MYFS_TTL_LEVELS][MYFS_TTL_SLOTS];
+	struct list_head ttl_expired;	/* due, waiting for the reaper */
+	time64_t ttl_clk;		/* last second the wheel processed */
+	unsigned long ttl_nr;		/* armed, including ttl_expired */
+	u64 ttl_expired_total, ttl_reaped, ttl_failed;
+	struct delayed_work ttl_work;
+	struct percpu_counter used_pages;	/* against mount_opts.max_pages */
+	spinlock_t lru_lock;		/* lru_list, purge_list, counters */
+	struct list_head lru_list;	/* regular files, cache=lru only */
+	unsigned long lru_nr;
+	u64 lru_evicted, lru_evicted_pages, lru_nospc;
+	struct llist_head lru_iput;	/* evicted inodes, see myfs_lru_iput() */
+	struct work_struct lru_iput_work;
+	struct list_head purge_list;	/* unpinned purgeable files, under lru_lock */
+	unsigned long purge_nr;
+	unsigned long purge_pages;	/* sum of their purge_counted */
+	u64 purged, purged_pages;
+	struct shrinker purge_shrinker;
+	struct mutex mig_mutex;		/* one migration pass at a time */
+	bool mig_active;		/* tag written pages for the next pass */
+	struct timespec64 mig_since;	/* start of the last pass */
+	bool frozen;			/* between ->freeze_fs and ->unfreeze_fs */
+	u64 freezes, freeze_wp_pages;	/* freeze stats, under s_umount */
+	u64 freeze_ns, frozen_ns, frozen_ns_max, frozen_at;
+	struct myfs_page_pool pools[MYFS_POOL_NR];
+};
+
+struct myfs_xattrs;
+struct myfs_blkdev;
+struct myfs_cluster;
+
+struct myfs_inode_info {
+	atomic_t		lock_contended;
+	atomic64_t		lock_time_ns;	/* as myfs_lock_stat.time_ns */
+	unsigned int		heat;		/* decaying access count */
+	unsigned long		heat_epoch;	/* half-lives since boot at last update */
+	unsigned int		seals;		/* F_SEAL_*, under the inode lock */
+	struct myfs_xattrs __rcu *xattrs;
+	struct myfs_blkdev	*blkdev;	/* exported disk, under the inode lock */
+	struct rb_root		dirents;	/* directories: ordered name index */
+	u64			ttl;		/* directories: default TTL, seconds */
+	time64_t		expires;	/* files: boottime second to unlink at */
+	struct list_head	ttl_node;	/* in the TTL wheel, under ttl_lock */
+	const struct cred	*ttl_cred;	/* armer's, unlinks as them; under ttl_lock */
+	struct user_namespace	*ttl_userns;	/* of the mount it was armed through */
+	unsigned long		nr_accounted;	/* pages in fsi->used_pages */
+	struct list_head	lru_node;	/* on fsi->lru_list */
+	bool			lru_ref;	/* CLOCK reference bit */
+	struct llist_node	lru_iput;	/* on fsi->lru_iput */
+	bool			lru_pinned;
+	unsigned int		purge;		/* MYFS_PURGE*, under the inode lock */
+	struct list_head	purge_node;	/* on fsi->purge_list */
+	unsigned long		purge_counted;	/* pages in fsi->purge_pages, under lru_lock */
+	u64			mig_trunc;	/* lowest size truncated to since the last pass */
+	struct myfs_cluster	*cluster_home;	/* chunk this inode lives in, or NULL */
+	struct myfs_cluster	*cluster;	/* directories: chunk for new children, under i_lock */
+	seqcount_t		write_seq;	/* bumped around untorn writes */
+	char			*untorn_buf;	/* set while untorn, under the inode lock */
+	struct inode		vfs_inode;
+};
+
+#define MYFS_PURGEABLE	0x1	/* unpinned: the shrinker may purge it */
+#define MYFS_PURGED	0x2	/* contents dropped, not pinned since */
+
+static inline struct myfs_inode_info *MYFS_I(struct inode *inode)
 {
-	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+	return container_of(inode, struct myfs_inode_info, vfs_inode);
+}
+
+static struct kmem_cache *myfs_inode_cachep;
+static struct dentry *myfs_debugfs_root;
+static struct address_space_operations myfs_aops __ro_after_init;
+
+/*
+ * Timing is off by default; ktime_get_ns() on every operation costs as
+ * much as many of them take.  Writing 1 to myfs/lock_timing in debugfs
+ * turns it on for the lock statistics, and each trace event turns it on
+ * for its own latencies while it is enabled.
+ */
+static DEFINE_STATIC_KEY_FALSE(myfs_lock_timing);
+
+static inline bool myfs_lock_timed(void)
+{
+	return static_branch_unlikely(&myfs_lock_timing);
+}
+
+/* Start of an operation traced by @event, or 0 if nothing will look. */
+#define myfs_op_start(event) \
+	(myfs_lock_timed() || trace_##event##_enabled() ? ktime_get_ns() : 0)
+
+static void myfs_lock_account(struct inode *inode, enum myfs_lock_class class,
+			      u64 time_ns, bool contended)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	struct myfs_lock_stat *st;
+
+	st = get_cpu_ptr(fsi->lock_stat);
+	st->acquired[class]++;
+	if (contended) {
+		st->contended[class]++;
+		st->time_ns[class] += time_ns;
+	}
+	put_cpu_ptr(fsi->lock_stat);
+
+	if (contended) {
+		atomic_inc(&MYFS_I(inode)->lock_contended);
+		atomic64_add(time_ns, &MYFS_I(inode)->lock_time_ns);
+	}
+}
+
+/*
+ * Called on the way out of a directory operation, with @dir still
+ * locked by the VFS since @start (0 if it was not timed).
+ */
+static void myfs_dir_account(struct inode *dir, u64 start)
+{
+	bool contended = rwsem_is_contended(&dir->i_rwsem);
+
+	myfs_lock_account(dir, MYFS_LOCK_DIR,
+			  contended && start ? ktime_get_ns() - start : 0,
+			  contended);
+}
+
+/*
+ * Per-cgroup QoS.  A rule limits the metadata operations per second and
+ * the data bytes per second (read and write) of a cgroup and everything
+ * below it on this mount.  Each limit is a token bucket holding one
+ * second's worth of tokens; CPUs take tokens from it in batches of
+ * 1/2^MYFS_QOS_BATCH_SHIFT of the rate into a per-CPU cache so the
+ * common case never touches the shared bucket.
+ *
+ * A charge that overdraws the bucket goes into debt and the caller
+ * sleeps until the debt is paid off, or gets -EAGAIN for IOCB_NOWAIT.
+ * Namespace operations and setattr run under a directory or inode lock
+ * the VFS took, where sleeping would stall every other tenant behind
+ * that lock, so they never wait: with the bucket empty they fail with
+ * -EDQUOT instead.
+ */
+enum myfs_qos_type {
+	MYFS_QOS_OPS,
+	MYFS_QOS_BYTES,
+	MYFS_QOS_NR,
+};
+
+#define MYFS_QOS_BATCH_SHIFT	8
+
+struct myfs_qos_bucket {
+	spinlock_t	lock;
+	u64		rate;		/* tokens per second, 0 = unlimited */
+	s64		tokens;
+	u64		last_ns;
+};
+
+struct myfs_qos_cache {
+	s64		tokens[MYFS_QOS_NR];
+};
+
+struct myfs_qos_rule {
+	struct hlist_node	node;
+	struct rcu_head		rcu;
+	u64			cgid;
+	struct myfs_qos_bucket	bucket[MYFS_QOS_NR];
+	struct myfs_qos_cache __percpu *cache;
+	atomic64_t		throttled;
+	atomic64_t		throttled_ns;
+	atomic64_t		rejected;
+};
+
+static struct myfs_qos_rule *myfs_qos_find(struct myfs_fs_info *fsi)
+{
+#ifdef CONFIG_CGROUPS
+	struct myfs_qos_rule *rule;
+	struct cgroup *cgrp;
+
+	for (cgrp = task_dfl_cgroup(current); cgrp; cgrp = cgroup_parent(cgrp)) {
+		u64 id = cgroup_id(cgrp);
+
+		hash_for_each_possible_rcu(fsi->qos_rules, rule, node, id)
+			if (rule->cgid == id)
+				return rule;
+	}
+#endif
+	return NULL;
+}
+
+static void myfs_qos_refill(struct myfs_qos_bucket *b, u64 now)
+{
+	u64 add = mul_u64_u64_div_u64(now - b->last_ns, b->rate, NSEC_PER_SEC);
+
+	if (!add)
+		return;
+	b->last_ns = now;
+	b->tokens = min_t(s64, b->tokens + add, b->rate);
+}
+
+/*
+ * Take @amount tokens.  Returns 0, the time in ns the caller has to sleep
+ * to pay back its debt, or -EAGAIN if @nowait and the bucket is empty.
+ */
+static s64 myfs_qos_take(struct myfs_qos_rule *rule, enum myfs_qos_type type,
+			 u64 amount, bool nowait)
+{
+	struct myfs_qos_bucket *b = &rule->bucket[type];
+	s64 *cache, wait = 0;
+	u64 batch;
+
+	if (!b->rate)
+		return 0;
+
+	cache = &get_cpu_ptr(rule->cache)->tokens[type];
+	if (*cache >= (s64)amount) {
+		*cache -= amount;
+		put_cpu_ptr(rule->cache);
+		return 0;
+	}
+	put_cpu_ptr(rule->cache);
+
+	batch = max_t(u64, b->rate >> MYFS_QOS_BATCH_SHIFT, 1);
+	spin_lock(&b->lock);
+	myfs_qos_refill(b, ktime_get_ns());
+	if (b->tokens >= (s64)(amount + batch)) {
+		b->tokens -= amount + batch;
+		this_cpu_add(rule->cache->tokens[type], batch);
+	} else if (nowait && b->tokens < (s64)amount) {
+		wait = -EAGAIN;
+	} else {
+		b->tokens -= amount;
+		if (b->tokens < 0)
+			wait = div64_u64((u64)-b->tokens * NSEC_PER_SEC, b->rate);
+	}
+	spin_unlock(&b->lock);
+	return wait;
+}
+
+static int myfs_qos_charge(struct super_block *sb, enum myfs_qos_type type,
+			   u64 amount, bool nowait)
+{
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_qos_rule *rule;
+	s64 wait = 0;
+
+	if (likely(!READ_ONCE(fsi->qos_nr_rules)) || !amount)
+		return 0;
+
+	rcu_read_lock();
+	rule = myfs_qos_find(fsi);
+	if (rule) {
+		wait = myfs_qos_take(rule, type, amount, nowait);
+		if (wait == -EAGAIN) {
+			atomic64_inc(&rule->rejected);
+		} else if (wait > 0) {
+			atomic64_inc(&rule->throttled);
+			atomic64_add(wait, &rule->throttled_ns);
+		}
+	}
+	rcu_read_unlock();
+
+	if (wait <= 0)
+		return wait;
+	if (schedule_timeout_killable(max_t(long, nsecs_to_jiffies(wait), 1)) &&
+	    fatal_signal_pending(current))
+		return -EINTR;
+	return 0;
+}
+
+/* One metadata op from under a lock the VFS holds for us. */
+static int myfs_qos_charge_locked(struct super_block *sb)
+{
+	int ret = myfs_qos_charge(sb, MYFS_QOS_OPS, 1, true);
+
+	return ret == -EAGAIN ? -EDQUOT : ret;
+}
+
+static void myfs_qos_free_rule(struct rcu_head *head)
+{
+	struct myfs_qos_rule *rule = container_of(head, struct myfs_qos_rule, rcu);
+
+	free_percpu(rule->cache);
+	kfree(rule);
+}
+
+/* Install, update or (with both rates 0) remove the rule for @cgid. */
+static int myfs_qos_set(struct myfs_fs_info *fsi, u64 cgid, u64 ops, u64 bytes)
+{
+	struct myfs_qos_rule *rule, *old = NULL;
+	int i;
+
+	mutex_lock(&fsi->qos_mutex);
+	hash_for_each_possible(fsi->qos_rules, rule, node, cgid)
+		if (rule->cgid == cgid)
+			old = rule;
+	if (old) {
+		hash_del_rcu(&old->node);
+		fsi->qos_nr_rules--;
+		call_rcu(&old->rcu, myfs_qos_free_rule);
+	}
+	if (!ops && !bytes) {
+		mutex_unlock(&fsi->qos_mutex);
+		return 0;
+	}
+
+	rule = kzalloc(sizeof(*rule), GFP_KERNEL);
+	if (rule)
+		rule->cache = alloc_percpu(struct myfs_qos_cache);
+	if (!rule || !rule->cache) {
+		kfree(rule);
+		mutex_unlock(&fsi->qos_mutex);
+		return -ENOMEM;
+	}
+	rule->cgid = cgid;
+	rule->bucket[MYFS_QOS_OPS].rate = ops;
+	rule->bucket[MYFS_QOS_BYTES].rate = bytes;
+	for (i = 0; i < MYFS_QOS_NR; i++) {
+		spin_lock_init(&rule->bucket[i].lock);
+		rule->bucket[i].tokens = rule->bucket[i].rate;
+		rule->bucket[i].last_ns = ktime_get_ns();
+	}
+	hash_add_rcu(fsi->qos_rules, &rule->node, cgid);
+	WRITE_ONCE(fsi->qos_nr_rules, fsi->qos_nr_rules + 1);
+	mutex_unlock(&fsi->qos_mutex);
+	return 0;
+}
+
+static void myfs_qos_clear(struct myfs_fs_info *fsi)
+{
+	struct myfs_qos_rule *rule;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(fsi->qos_rules, bkt, tmp, rule, node) {
+		hash_del(&rule->node);
+		free_percpu(rule->cache);
+		kfree(rule);
+	}
+	fsi->qos_nr_rules = 0;
+}
+
+/*
+ * Access heat: every half-life the per-inode counter is halved, so it
+ * approximates the number of recent accesses.  Reads, writes and faults
+ * of a file that is already warm are sampled one in MYFS_HEAT_SAMPLE to
+ * keep the shared cacheline quiet; a sampled hit is worth
+ * MYFS_HEAT_SAMPLE accesses.
+ */
+#define MYFS_HEAT_HALFLIFE	(60 * HZ)
+#define MYFS_HEAT_SAMPLE	8
+
+static DEFINE_PER_CPU(unsigned int, myfs_heat_tick);
+
+static unsigned int myfs_heat_decay(unsigned int heat, unsigned long then,
+				    unsigned long now)
+{
+	return now - then >= 32 ? 0 : heat >> (now - then);
+}
+
+static void myfs_heat_touch(struct inode *inode)
+{
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	unsigned long now = jiffies / MYFS_HEAT_HALFLIFE;
+	unsigned long epoch = READ_ONCE(mi->heat_epoch);
+	unsigned int heat = READ_ONCE(mi->heat);
+
+	if (!READ_ONCE(mi->lru_ref))
+		WRITE_ONCE(mi->lru_ref, true);
+	if (heat && (this_cpu_inc_return(myfs_heat_tick) & (MYFS_HEAT_SAMPLE - 1)))
+		return;
+	if (epoch != now) {
+		heat = myfs_heat_decay(heat, epoch, now);
+		WRITE_ONCE(mi->heat_epoch, now);
+	}
+	WRITE_ONCE(mi->heat, heat > UINT_MAX - MYFS_HEAT_SAMPLE ?
+			     UINT_MAX : heat + MYFS_HEAT_SAMPLE);
+}
+
+/*
+ * Current heat of @inode, decayed to now.  Cheap enough to be used by
+ * in-kernel placement or cleanup policies.
+ */
+unsigned int myfs_inode_heat(struct inode *inode)
+{
+	struct myfs_inode_info *mi = MYFS_I(inode);
+
+	return myfs_heat_decay(READ_ONCE(mi->heat), READ_ONCE(mi->heat_epoch),
+			       jiffies / MYFS_HEAT_HALFLIFE);
+}
+
+static bool myfs_file_lock(struct inode *inode, bool nowait)
+{
+	u64 start;
+
+	if (inode_trylock(inode)) {
+		myfs_lock_account(inode, MYFS_LOCK_FILE, 0, false);
+		return true;
+	}
+	if (nowait) {
+		myfs_lock_account(inode, MYFS_LOCK_FILE, 0, true);
+		return false;
+	}
+	start = myfs_lock_timed() ? ktime_get_ns() : 0;
+	inode_lock(inode);
+	myfs_lock_account(inode, MYFS_LOCK_FILE,
+			  start ? ktime_get_ns() - start : 0, true);
+	return true;
+}
+
+/*
+ * Untorn writes.  After MYFS_IOC_SET_UNTORN, read() and loads through a
+ * mapping see a write of at most MYFS_UNTORN_MAX bytes to the file
+ * either whole or not at all.  The data is copied into the file's bounce
+ * buffer and the pages are prepared and locked first; only then is it
+ * copied into the page cache, inside write_seq, which readers retry on.
+ * A reader that keeps losing the race falls back to the inode lock.
+ * Mapped pages of the range are unmapped while they are locked, so a
+ * load faults and waits for the page lock.  Stores through a mapping are
+ * not ordered against write() and can still tear it.
+ */
+#define MYFS_UNTORN_MAX		(64 * 1024)
+#define MYFS_UNTORN_PAGES	(DIV_ROUND_UP(MYFS_UNTORN_MAX, PAGE_SIZE) + 1)
+#define MYFS_UNTORN_RETRIES	4
+
+static size_t myfs_untorn_seg(loff_t pos, size_t left)
+{
+	return min_t(size_t, left, PAGE_SIZE - offset_in_page(pos));
+}
+
+static void myfs_account(struct inode *inode);
+
+/* Called with the inode locked, after generic_write_checks(). */
+static ssize_t myfs_write_untorn(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	struct page *pages[MYFS_UNTORN_PAGES];
+	void *fsdata[MYFS_UNTORN_PAGES];
+	size_t len = iov_iter_count(from), done, seg;
+	loff_t pos = iocb->ki_pos, end = pos + len;
+	loff_t isize = i_size_read(inode);
+	char *buf = mi->untorn_buf;
+	int nr = 0, i;
+	ssize_t ret;
+
+	if (copy_from_iter(buf, len, from) != len)
+		return -EFAULT;
+	ret = file_remove_privs(file);
+	if (!ret)
+		ret = file_update_time(file);
+	if (ret)
+		return ret;
+
+	for (done = 0; done < len; done += seg, nr++) {
+		seg = myfs_untorn_seg(pos + done, len - done);
+		ret = mapping->a_ops->write_begin(file, mapping, pos + done,
+						  seg, &pages[nr], &fsdata[nr]);
+		if (ret)
+			break;
+	}
+	if (!ret) {
+		if (mapping_mapped(mapping))
+			unmap_mapping_pages(mapping, pos >> PAGE_SHIFT, nr, false);
+		preempt_disable();
+		write_seqcount_begin(&mi->write_seq);
+		for (i = 0, done = 0; i < nr; i++, done += seg) {
+			seg = myfs_untorn_seg(pos + done, len - done);
+			memcpy_to_page(pages[i], offset_in_page(pos + done),
+				       buf + done, seg);
+		}
+		if (end > isize)
+			i_size_write(inode, end);
+		write_seqcount_end(&mi->write_seq);
+		preempt_enable();
+	}
+	for (i = 0, done = 0; i < nr; i++, done += seg) {
+		seg = myfs_untorn_seg(pos + done, len - done);
+		mapping->a_ops->write_end(file, mapping, pos + done, seg,
+					  ret ? 0 : seg, pages[i], fsdata[i]);
+	}
+	if (ret) {
+		/* write_end() moved i_size up to each page it was given */
+		if (i_size_read(inode) > isize) {
+			i_size_write(inode, isize);
+			truncate_pagecache(inode, isize);
+			myfs_account(inode);
+		}
+		return ret;
+	}
+	iocb->ki_pos = end;
+	return len;
+}
+
+static ssize_t myfs_read_untorn(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	loff_t pos = iocb->ki_pos;
+	unsigned int seq, tries;
+	ssize_t ret;
+
+	for (tries = 0; tries < MYFS_UNTORN_RETRIES; tries++) {
+		seq = read_seqcount_begin(&mi->write_seq);
+		ret = generic_file_read_iter(iocb, to);
+		if (ret <= 0 || !read_seqcount_retry(&mi->write_seq, seq))
+			return ret;
+		iov_iter_revert(to, ret);
+		iocb->ki_pos = pos;
+	}
+
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!inode_trylock_shared(inode))
+			return -EAGAIN;
+	} else {
+		inode_lock_shared(inode);
+	}
+	ret = generic_file_read_iter(iocb, to);
+	inode_unlock_shared(inode);
+	return ret;
+}
+
+static long myfs_ioc_untorn(struct file *file, unsigned int cmd,
+			    void __user *argp)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	struct myfs_untorn_info info = {};
+	char *buf = NULL;
+	u32 on;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+	if (cmd == MYFS_IOC_GET_UNTORN) {
+		info.enabled = !!READ_ONCE(mi->untorn_buf);
+		info.unit_min = 1;
+		info.unit_max = MYFS_UNTORN_MAX;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+	if (!inode_owner_or_capable(file_mnt_user_ns(file), inode))
+		return -EPERM;
+	if (get_user(on, (u32 __user *)argp))
+		return -EFAULT;
+	if (on) {
+		buf = kvmalloc(MYFS_UNTORN_MAX, GFP_KERNEL_ACCOUNT);
+		if (!buf)
+			return -ENOMEM;
+	}
+	inode_lock(inode);
+	if (!on || !mi->untorn_buf)
+		swap(buf, mi->untorn_buf);
+	inode_unlock(inode);
+	kvfree(buf);
+	return 0;
+}
+
+static ssize_t myfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	loff_t pos = iocb->ki_pos;
+	size_t len = iov_iter_count(from);
+	u64 start = myfs_op_start(myfs_rw);
+	ssize_t ret;
+
+	myfs_heat_touch(inode);
+	ret = myfs_qos_charge(inode->i_sb, MYFS_QOS_BYTES, len,
+			      iocb->ki_flags & IOCB_NOWAIT);
+	if (ret)
+		return ret;
+	if (!myfs_file_lock(inode, iocb->ki_flags & IOCB_NOWAIT))
+		return -EAGAIN;
+	if (unlikely(MYFS_I(inode)->purge & MYFS_PURGED))
+		ret = -ENODATA;
+	else
+		ret = generic_write_checks(iocb, from);
+	if (ret > 0) {
+		pos = iocb->ki_pos;
+		if (MYFS_I(inode)->untorn_buf && ret <= MYFS_UNTORN_MAX)
+			ret = myfs_write_untorn(iocb, from);
+		else
+			ret = __generic_file_write_iter(iocb, from);
+	}
+	inode_unlock(inode);
+
+	if (ret > 0)
+		ret = generic_write_sync(iocb, ret);
+	trace_myfs_rw("write", inode, pos, len, ret, start);
+	return ret;
+}
+
+/*
+ * Size limit and cache=lru.  With size= set, the pages of regular files
+ * count against the limit in fsi->used_pages; each inode remembers how
+ * many it added, and myfs_account() brings that up to date after every
+ * path that adds or drops pages.  A page allocation that does not fit
+ * fails with -ENOSPC, unless the mount is cache=lru.  Then the coldest
+ * whole files are unlinked until it fits.  Regular files sit on
+ * fsi->lru_list and myfs_heat_touch() sets their reference bit, so
+ * eviction is CLOCK: a referenced file has its bit cleared and goes to
+ * the tail, an unreferenced one is unlinked.  Pinned files
+ * (MYFS_IOC_SET_LRU_PIN) are skipped, as are open or mapped ones,
+ * because unlinking those would free nothing.  The caller holds the lock
+ * of the file being grown, and maybe mmap_lock, so eviction only uses
+ * trylocks and skips anything busy, and the final iput of a victim,
+ * which truncates its pages, is left to a worker.  Each eviction is an
+ * fsnotify delete in the parent directory and a myfs_evict trace event.
+ */
+#define MYFS_LRU_SCAN	2	/* passes over lru_list before giving up */
+
+static void myfs_dirent_del(struct inode *dir, const struct qstr *name);
+
+static void myfs_account(struct inode *inode)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	unsigned long nr = READ_ONCE(inode->i_mapping->nrpages);
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	long delta = nr - xchg(&mi->nr_accounted, nr);
+
+	if (!delta)
+		return;
+	percpu_counter_add(&fsi->used_pages, delta);
+	/* pairs with the smp_mb() in myfs_ioc_purge() */
+	if (list_empty_careful(&mi->purge_node))
+		return;
+	spin_lock(&fsi->lru_lock);
+	if (!list_empty(&mi->purge_node)) {
+		nr = READ_ONCE(mi->nr_accounted);
+		fsi->purge_pages += nr - mi->purge_counted;
+		mi->purge_counted = nr;
+	}
+	spin_unlock(&fsi->lru_lock);
+}
+
+static bool myfs_size_fits(struct myfs_fs_info *fsi, unsigned long nr)
+{
+	unsigned long max = fsi->mount_opts.max_pages;
+
+	return nr <= max &&
+	       percpu_counter_compare(&fsi->used_pages, max - nr) <= 0;
+}
+
+static void myfs_lru_add(struct inode *inode)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+
+	spin_lock(&fsi->lru_lock);
+	list_add_tail(&MYFS_I(inode)->lru_node, &fsi->lru_list);
+	fsi->lru_nr++;
+	spin_unlock(&fsi->lru_lock);
+}
+
+static void myfs_lru_del(struct inode *inode)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+
+	if (list_empty_careful(&mi->lru_node))
+		return;
+	spin_lock(&fsi->lru_lock);
+	list_del_init(&mi->lru_node);
+	fsi->lru_nr--;
+	spin_unlock(&fsi->lru_lock);
+}
+
+/*
+ * Unlink a name nobody is using, with trylocks only.  This is the
+ * filesystem reclaiming space, not a caller's unlink, so it goes
+ * straight to simple_unlink(): no LSM hook and no QoS charge to
+ * whichever writer happened to need the room.
+ */
+static int myfs_lru_unlink(struct dentry *dentry)
+{
+	struct dentry *parent = dget_parent(dentry);
+	struct inode *dir = d_inode(parent);
+	struct inode *inode = d_inode(dentry);
+	int error = -EBUSY;
+
+	if (!inode_trylock(dir))
+		goto out;
+	if (!inode_trylock(inode))
+		goto out_dir;
+	/* the pin taken at create time and our own reference */
+	if (dentry->d_parent != parent || d_unhashed(dentry) ||
+	    d_count(dentry) > 2 || d_mountpoint(dentry))
+		goto out_inode;
+	error = simple_unlink(dir, dentry);
+	if (!error) {
+		myfs_dirent_del(dir, &dentry->d_name);
+		dentry->d_time = 0;
+		dont_mount(dentry);
+	}
+out_inode:
+	inode_unlock(inode);
+	if (!error) {
+		fsnotify_link_count(inode);
+		d_delete_notify(dir, dentry);
+	}
+out_dir:
+	inode_unlock(dir);
+out:
+	dput(parent);
+	return error;
+}
+
+/*
+ * Unlink every name of @inode unless it is in use; returns pages freed.
+ * They come off used_pages now, though the final iput that frees them
+ * waits for myfs_lru_iput_work().
+ */
+static unsigned long myfs_lru_evict(struct inode *inode)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	unsigned long nr = inode->i_mapping->nrpages;
+	struct dentry *dentry;
+	int error = 0;
+
+	if (!inode->i_nlink || mapping_mapped(inode->i_mapping))
+		return 0;
+	while (!error && (dentry = d_find_alias(inode))) {
+		error = myfs_lru_unlink(dentry);
+		dput(dentry);
+	}
+	if (inode->i_nlink)
+		return 0;
+	percpu_counter_sub(&fsi->used_pages,
+			   xchg(&MYFS_I(inode)->nr_accounted, 0));
+	trace_myfs_evict("lru", inode, nr);
+	return nr;
+}
+
+static void myfs_lru_iput_work(struct work_struct *work)
+{
+	struct myfs_fs_info *fsi = container_of(work, struct myfs_fs_info,
+						lru_iput_work);
+	struct myfs_inode_info *mi, *next;
+
+	llist_for_each_entry_safe(mi, next, llist_del_all(&fsi->lru_iput), lru_iput) {
+		iput(&mi->vfs_inode);
+		cond_resched();
+	}
+}
+
+/*
+ * Drop make_room's reference to a victim.  Its caller may hold the lock
+ * of a page it is filling, the inode lock and mmap_lock, so the last
+ * reference, whose evict_inode() truncates the victim's whole page cache,
+ * goes to a worker instead.  The queue owns that reference while the
+ * inode is on it, so nobody else can find it the last and queue it twice.
+ */
+static void myfs_lru_iput(struct inode *inode)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+
+	if (atomic_add_unless(&inode->i_count, -1, 1))
+		return;
+	if (llist_add(&MYFS_I(inode)->lru_iput, &fsi->lru_iput))
+		queue_work(system_unbound_wq, &fsi->lru_iput_work);
+}
+
+/* Evict files other than @self until @nr more pages fit. */
+static int myfs_lru_make_room(struct inode *self, unsigned long nr)
+{
+	struct super_block *sb = self->i_sb;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_inode_info *mi;
+	struct inode *inode;
+	unsigned long scan, freed;
+	bool fits;
+
+	if (fsi->mount_opts.lru && sb_start_write_trylock(sb)) {
+		spin_lock(&fsi->lru_lock);
+		scan = fsi->lru_nr * MYFS_LRU_SCAN;
+		spin_unlock(&fsi->lru_lock);
+
+		while (scan-- && !myfs_size_fits(fsi, nr)) {
+			inode = NULL;
+			spin_lock(&fsi->lru_lock);
+			if (list_empty(&fsi->lru_list)) {
+				spin_unlock(&fsi->lru_lock);
+				break;
+			}
+			mi = list_first_entry(&fsi->lru_list,
+					      struct myfs_inode_info, lru_node);
+			list_move_tail(&mi->lru_node, &fsi->lru_list);
+			if (READ_ONCE(mi->lru_ref))
+				WRITE_ONCE(mi->lru_ref, false);
+			else if (&mi->vfs_inode != self && !READ_ONCE(mi->lru_pinned))
+				inode = igrab(&mi->vfs_inode);
+			spin_unlock(&fsi->lru_lock);
+			if (!inode)
+				continue;
+
+			freed = myfs_lru_evict(inode);
+			myfs_lru_iput(inode);
+			if (freed) {
+				spin_lock(&fsi->lru_lock);
+				fsi->lru_evicted++;
+				fsi->lru_evicted_pages += freed;
+				spin_unlock(&fsi->lru_lock);
+			}
+			cond_resched();
+		}
+		sb_end_write(sb);
+	}
+
+	fits = myfs_size_fits(fsi, nr);
+	if (!fits) {
+		spin_lock(&fsi->lru_lock);
+		fsi->lru_nospc++;
+		spin_unlock(&fsi->lru_lock);
+	}
+	return fits ? 0 : -ENOSPC;
+}
+
+/*
+ * Called before adding page @index of @inode to the page cache.  Does
+ * nothing unless the mount has a size limit and is close to it.
+ */
+static int myfs_reserve_page(struct inode *inode, pgoff_t index)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	loff_t pos = (loff_t)index << PAGE_SHIFT;
+
+	if (!fsi->mount_opts.max_pages || myfs_size_fits(fsi, 1))
+		return 0;
+	if (filemap_range_has_page(inode->i_mapping, pos, pos + PAGE_SIZE - 1))
+		return 0;
+	return myfs_lru_make_room(inode, 1);
+}
+
+static long myfs_ioc_lru_pin(struct file *file, unsigned int cmd,
+			     u32 __user *argp)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	u32 pin;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+	if (cmd == MYFS_IOC_GET_LRU_PIN)
+		return put_user(READ_ONCE(mi->lru_pinned), argp);
+	if (!inode_owner_or_capable(file_mnt_user_ns(file), inode))
+		return -EPERM;
+	if (get_user(pin, argp))
+		return -EFAULT;
+	WRITE_ONCE(mi->lru_pinned, !!pin);
+	return 0;
+}
+
+/*
+ * Purgeable files, after ashmem.  MYFS_IOC_PURGE_UNPIN puts a file on
+ * fsi->purge_list, and under memory pressure the per-superblock
+ * shrinker drops the contents of files on it, oldest unpin first.  A
+ * purged file keeps its size, but reads and writes fail with -ENODATA
+ * and faults raise SIGBUS until MYFS_IOC_PURGE_PIN, which reports the
+ * purge and leaves the file reading as zeros.  Reclaim must not wait on
+ * anything a faulting task may hold, so the shrinker only trylocks the
+ * inode and its pages; pages it skips are dropped at the next pin.
+ * fsi->purge_pages keeps the pages on the list for count_objects, kept
+ * current by myfs_account() as the files grow and shrink.
+ */
+static void myfs_purge_del(struct inode *inode)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+
+	if (list_empty_careful(&mi->purge_node))
+		return;
+	spin_lock(&fsi->lru_lock);
+	if (!list_empty(&mi->purge_node)) {
+		list_del_init(&mi->purge_node);
+		fsi->purge_nr--;
+		fsi->purge_pages -= mi->purge_counted;
+		mi->purge_counted = 0;
+	}
+	spin_unlock(&fsi->lru_lock);
+}
+
+/* Drop the contents of @inode if it is still purgeable; returns pages freed. */
+static unsigned long myfs_purge(struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	unsigned long nr = 0;
+	pgoff_t index, end;
+	struct page *page;
+
+	if (!inode_trylock(inode))
+		return 0;
+	if (mi->purge != MYFS_PURGEABLE)
+		goto out;
+	WRITE_ONCE(mi->purge, MYFS_PURGEABLE | MYFS_PURGED);
+	myfs_purge_del(inode);
+	mi->mig_trunc = 0;
+
+	nr = mapping->nrpages;
+	unmap_mapping_range(mapping, 0, 0, 0);
+	end = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
+	for (index = 0; index < end && mapping->nrpages; index++) {
+		page = pagecache_get_page(mapping, index, FGP_LOCK | FGP_NOWAIT, 0);
+		if (!page)
+			continue;
+		generic_error_remove_page(mapping, page);
+		unlock_page(page);
+		put_page(page);
+		cond_resched();
+	}
+	nr -= mapping->nrpages;
+	myfs_account(inode);
+	trace_myfs_evict("purge", inode, nr);
+out:
+	inode_unlock(inode);
+	return nr;
+}
+
+static unsigned long myfs_purge_count(struct shrinker *shrink,
+				      struct shrink_control *sc)
+{
+	struct myfs_fs_info *fsi = container_of(shrink, struct myfs_fs_info,
+						purge_shrinker);
+
+	return READ_ONCE(fsi->purge_pages) ?: SHRINK_EMPTY;
+}
+
+static unsigned long myfs_purge_scan(struct shrinker *shrink,
+				     struct shrink_control *sc)
+{
+	struct myfs_fs_info *fsi = container_of(shrink, struct myfs_fs_info,
+						purge_shrinker);
+	struct myfs_inode_info *mi;
+	struct inode *inode;
+	unsigned long freed = 0, scan, nr;
+
+	if (!(sc->gfp_mask & __GFP_FS))
+		return SHRINK_STOP;
+	/* a frozen mount keeps its contents */
+	if (!sb_start_write_trylock(fsi->sb))
+		return SHRINK_STOP;
+	spin_lock(&fsi->lru_lock);
+	scan = fsi->purge_nr;
+	spin_unlock(&fsi->lru_lock);
+
+	while (scan-- && freed < sc->nr_to_scan) {
+		spin_lock(&fsi->lru_lock);
+		if (list_empty(&fsi->purge_list)) {
+			spin_unlock(&fsi->lru_lock);
+			break;
+		}
+		mi = list_first_entry(&fsi->purge_list, struct myfs_inode_info,
+				      purge_node);
+		list_move_tail(&mi->purge_node, &fsi->purge_list);
+		inode = igrab(&mi->vfs_inode);
+		spin_unlock(&fsi->lru_lock);
+		if (!inode)
+			continue;
+
+		nr = myfs_purge(inode);
+		iput(inode);
+		if (nr) {
+			freed += nr;
+			spin_lock(&fsi->lru_lock);
+			fsi->purged++;
+			fsi->purged_pages += nr;
+			spin_unlock(&fsi->lru_lock);
+		}
+	}
+	sb_end_write(fsi->sb);
+	return freed ?: SHRINK_STOP;
+}
+
+static long myfs_ioc_purge(struct file *file, unsigned int cmd)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	long ret = 0;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+	if (!(file->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	inode_lock(inode);
+	if (cmd == MYFS_IOC_PURGE_UNPIN) {
+		/* purging would change what a disk or a write seal promises */
+		ret = -EBUSY;
+		if (mi->blkdev)
+			goto out;
+		ret = -EPERM;
+		if (mi->seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))
+			goto out;
+		ret = 0;
+		if (mi->purge)
+			goto out;
+		WRITE_ONCE(mi->purge, MYFS_PURGEABLE);
+		spin_lock(&fsi->lru_lock);
+		list_add_tail(&mi->purge_node, &fsi->purge_list);
+		fsi->purge_nr++;
+		/* a racing myfs_account() either sees us listed or we see its pages */
+		smp_mb();
+		mi->purge_counted = READ_ONCE(mi->nr_accounted);
+		fsi->purge_pages += mi->purge_counted;
+		spin_unlock(&fsi->lru_lock);
+	} else {
+		myfs_purge_del(inode);
+		if (mi->purge & MYFS_PURGED) {
+			/* whatever the shrinker had to skip */
+			truncate_pagecache(inode, 0);
+			myfs_account(inode);
+			ret = MYFS_PURGE_WAS_PURGED;
+		}
+		WRITE_ONCE(mi->purge, 0);
+	}
+out:
+	inode_unlock(inode);
+	return ret;
+}
+
+static ssize_t myfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	loff_t pos = iocb->ki_pos;
+	size_t len = iov_iter_count(to);
+	u64 start = myfs_op_start(myfs_rw);
+	ssize_t ret;
+
+	myfs_heat_touch(inode);
+	if (unlikely(READ_ONCE(MYFS_I(inode)->purge) & MYFS_PURGED))
+		return -ENODATA;
+	ret = myfs_qos_charge(inode->i_sb, MYFS_QOS_BYTES, len,
+			      iocb->ki_flags & IOCB_NOWAIT);
+	if (ret)
+		goto out;
+	if (READ_ONCE(MYFS_I(inode)->untorn_buf))
+		ret = myfs_read_untorn(iocb, to);
+	else
+		ret = generic_file_read_iter(iocb, to);
+out:
+	trace_myfs_rw("read", inode, pos, len, ret, start);
+	return ret;
+}
+
+/* Tag a written page for the next pass of myfs_ioc_migrate(). */
+static void myfs_mig_mark(struct address_space *mapping, pgoff_t index)
+{
+	struct myfs_fs_info *fsi = mapping->host->i_sb->s_fs_info;
+
+	if (!READ_ONCE(fsi->mig_active))
+		return;
+	xa_lock_irq(&mapping->i_pages);
+	__xa_set_mark(&mapping->i_pages, index, PAGECACHE_TAG_TOWRITE);
+	xa_unlock_irq(&mapping->i_pages);
+}
+
+static vm_fault_t myfs_filemap_fault(struct vm_fault *vmf)
+{
+	struct inode *inode = file_inode(vmf->vma->vm_file);
+	u64 start = myfs_op_start(myfs_rw);
+	vm_fault_t ret;
+
+	myfs_heat_touch(inode);
+	if (unlikely(READ_ONCE(MYFS_I(inode)->purge) & MYFS_PURGED))
+		return VM_FAULT_SIGBUS;
+	ret = vmf_error(myfs_reserve_page(inode, vmf->pgoff));
+	if (!ret) {
+		ret = filemap_fault(vmf);
+		myfs_account(inode);
+	}
+	trace_myfs_rw("fault", inode, (loff_t)vmf->pgoff << PAGE_SHIFT,
+		      PAGE_SIZE, ret, start);
+	return ret;
+}
+
+static vm_fault_t myfs_map_pages(struct vm_fault *vmf,
+				 pgoff_t start_pgoff, pgoff_t end_pgoff)
+{
+	struct inode *inode = file_inode(vmf->vma->vm_file);
+
+	myfs_heat_touch(inode);
+	/* leave it to ->fault to raise SIGBUS */
+	if (unlikely(READ_ONCE(MYFS_I(inode)->purge) & MYFS_PURGED))
+		return 0;
+	return filemap_map_pages(vmf, start_pgoff, end_pgoff);
+}
+
+static vm_fault_t myfs_page_mkwrite(struct vm_fault *vmf)
+{
+	vm_fault_t ret = filemap_page_mkwrite(vmf);
+
+	if (ret & VM_FAULT_LOCKED)
+		myfs_mig_mark(vmf->vma->vm_file->f_mapping, vmf->page->index);
+	return ret;
+}
+
+/*
+ * No userfaultfd here: vma_can_userfault() only admits anonymous, shmem
+ * and hugetlb VMAs (minor mode just the last two), and handle_userfault()
+ * is not exported, so UFFDIO_REGISTER on a myfs mapping fails with
+ * -EINVAL whatever these ops do.
+ */
+static const struct vm_operations_struct myfs_file_vm_ops = {
+	.fault		= myfs_filemap_fault,
+	.map_pages	= myfs_map_pages,
+	.page_mkwrite	= myfs_page_mkwrite,
+};
+
+static int myfs_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	unsigned int seals = READ_ONCE(MYFS_I(file_inode(file))->seals);
+
+	/*
+	 * F_SEAL_WRITE already made the mapping deny writable maps; both
+	 * write seals also keep a shared mapping from becoming writable
+	 * later through mprotect().
+	 */
+	if ((vma->vm_flags & VM_SHARED) &&
+	    (seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+	file_accessed(file);
+	vma->vm_ops = &myfs_file_vm_ops;
+	return 0;
+}
+
+/*
+ * Write-lifetime hints.  A file inherits its directory's i_write_hint
+ * when it is created (F_SET_RW_HINT works on a directory too).  Pages
+ * written to a file with a short or a long hint come from a per-mount
+ * pool for that class: an order-MYFS_POOL_ORDER block, split and handed
+ * out in order.  Data of one lifetime thus shares pageblocks, and when
+ * short-lived files go their blocks coalesce again instead of leaving
+ * holes between long-lived pages.  Files without a hint, and writes
+ * when no block can be had without direct reclaim, use the page
+ * allocator as before.
+ */
+static int myfs_pool_class(struct inode *inode)
+{
+	switch (inode->i_write_hint) {
+	case WRITE_LIFE_SHORT:
+	case WRITE_LIFE_MEDIUM:
+		return MYFS_POOL_SHORT;
+	case WRITE_LIFE_LONG:
+	case WRITE_LIFE_EXTREME:
+		return MYFS_POOL_LONG;
+	default:
+		return -1;
+	}
+}
+
+static struct page *myfs_pool_take(struct myfs_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (pool->left) {
+		page = nth_page(pool->block, pool->next++);
+		pool->left--;
+		pool->pages++;
+	}
+	spin_unlock(&pool->lock);
+	return page;
+}
+
+static struct page *myfs_pool_alloc(struct myfs_page_pool *pool, gfp_t gfp)
+{
+	struct page *page;
+	unsigned int i;
+
+	page = myfs_pool_take(pool);
+	if (page)
+		return page;
+
+	gfp = (gfp | __GFP_NOWARN | __GFP_NORETRY) & ~__GFP_DIRECT_RECLAIM;
+	page = alloc_pages(gfp, MYFS_POOL_ORDER);
+	if (!page) {
+		spin_lock(&pool->lock);
+		pool->fallbacks++;
+		spin_unlock(&pool->lock);
+		return NULL;
+	}
+	split_page(page, MYFS_POOL_ORDER);
+
+	spin_lock(&pool->lock);
+	if (pool->left) {
+		/* refilled meanwhile */
+		spin_unlock(&pool->lock);
+		for (i = 0; i < (1U << MYFS_POOL_ORDER); i++)
+			__free_page(nth_page(page, i));
+		return myfs_pool_take(pool);
+	}
+	pool->block = page;
+	pool->next = 1;
+	pool->left = (1U << MYFS_POOL_ORDER) - 1;
+	pool->blocks++;
+	pool->pages++;
+	spin_unlock(&pool->lock);
+	return page;
+}
+
+static void myfs_pools_release(struct myfs_fs_info *fsi)
+{
+	struct myfs_page_pool *pool;
+	int i;
+
+	for (i = 0; i < MYFS_POOL_NR; i++) {
+		pool = &fsi->pools[i];
+		while (pool->left) {
+			__free_page(nth_page(pool->block, pool->next++));
+			pool->left--;
+		}
+	}
+}
+
+/* grab_cache_page_write_begin(), from the pool of @mapping's lifetime */
+static struct page *myfs_grab_page(struct address_space *mapping,
+				   pgoff_t index)
+{
+	struct inode *inode = mapping->host;
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	gfp_t gfp = mapping_gfp_mask(mapping);
+	int class = myfs_pool_class(inode);
+	struct page *page;
+	int error;
+
+	if (class < 0)
+		return grab_cache_page_write_begin(mapping, index);
+	page = find_lock_page(mapping, index);
+	if (page)
+		return page;
+	page = myfs_pool_alloc(&fsi->pools[class], gfp);
+	if (!page)
+		return grab_cache_page_write_begin(mapping, index);
+	error = add_to_page_cache_lru(page, mapping, index, gfp);
+	if (error) {
+		put_page(page);
+		/* raced with another writer or a fault */
+		if (error == -EEXIST)
+			return grab_cache_page_write_begin(mapping, index);
+		return NULL;
+	}
+	return page;
+}
+
+static int myfs_write_begin(struct file *file, struct address_space *mapping,
+			    loff_t pos, unsigned len, struct page **pagep,
+			    void **fsdata)
+{
+	unsigned int seals = MYFS_I(mapping->host)->seals;
+	u64 start = myfs_lock_timed() ? ktime_get_ns() : 0;
+	struct page *page;
+	u64 delta = 0;
+	int ret;
+
+	/* called under the inode lock, so the seals cannot change under us */
+	if (unlikely(seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE | F_SEAL_GROW))) {
+		if (seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))
+			return -EPERM;
+		if (pos + len > i_size_read(mapping->host))
+			return -EPERM;
+	}
+
+	ret = myfs_reserve_page(mapping->host, pos >> PAGE_SHIFT);
+	if (ret)
+		return ret;
+	page = myfs_grab_page(mapping, pos >> PAGE_SHIFT);
+	if (page) {
+		/* as simple_write_begin() */
+		if (!PageUptodate(page) && len != PAGE_SIZE) {
+			unsigned int from = offset_in_page(pos);
+
+			zero_user_segments(page, 0, from, from + len, PAGE_SIZE);
+		}
+		*pagep = page;
+	} else {
+		ret = -ENOMEM;
+	}
+	if (start)
+		delta = ktime_get_ns() - start;
+	myfs_lock_account(mapping->host, MYFS_LOCK_MAPPING, delta,
+			  delta > MYFS_LOCK_SLOW_NS);
+	return ret;
+}
+
+static int myfs_write_end(struct file *file, struct address_space *mapping,
+			  loff_t pos, unsigned len, unsigned copied,
+			  struct page *page, void *fsdata)
+{
+	int ret = simple_write_end(file, mapping, pos, len, copied, page,
+				   fsdata);
+
+	if (ret > 0)
+		myfs_mig_mark(mapping, pos >> PAGE_SHIFT);
+	myfs_account(mapping->host);
+	return ret;
+}
+
+/*
+ * Parallel population for fallocate() and POSIX_FADV_WILLNEED.  Zeroing
+ * a large range from one thread is bound by one core's memory bandwidth,
+ * so the range is handed out in MYFS_POPULATE_CHUNK-page pieces to up to
+ * one worker per CPU.  The workers run on the unbound myfs_populate_wq
+ * and are spread over the nodes the caller may allocate from.  The
+ * caller waits for them.  MAP_POPULATE and MADV_POPULATE_WRITE fault
+ * from the calling thread without asking the filesystem, so they only
+ * go fast on a range that was already populated this way.
+ */
+#define MYFS_POPULATE_CHUNK	512		/* pages */
+
+struct myfs_populate;
+
+struct myfs_populate_work {
+	struct work_struct	work;
+	struct myfs_populate	*p;
+};
+
+struct myfs_populate {
+	struct address_space	*mapping;
+	atomic_long_t		next;
+	pgoff_t			end;
+	atomic_t		error;
+	atomic_t		pending;
+	struct completion	done;
+	struct myfs_populate_work works[];
+};
+
+static struct workqueue_struct *myfs_populate_wq;
+
+static void myfs_populate_worker(struct work_struct *work)
+{
+	struct myfs_populate *p = container_of(work, struct myfs_populate_work,
+					       work)->p;
+	struct address_space *mapping = p->mapping;
+	pgoff_t index, last;
+	int error;
+
+	while (!atomic_read(&p->error)) {
+		index = atomic_long_fetch_add(MYFS_POPULATE_CHUNK, &p->next);
+		if (index >= p->end)
+			break;
+		last = min_t(pgoff_t, index + MYFS_POPULATE_CHUNK, p->end);
+		for (; index < last; index++) {
+			struct page *page;
+
+			error = myfs_reserve_page(mapping->host, index);
+			if (error) {
+				atomic_cmpxchg(&p->error, 0, error);
+				break;
+			}
+			page = find_or_create_page(mapping, index,
+						   mapping_gfp_mask(mapping));
+			if (!page) {
+				atomic_cmpxchg(&p->error, 0, -ENOMEM);
+				break;
+			}
+			if (!PageUptodate(page)) {
+				clear_highpage(page);
+				flush_dcache_page(page);
+				SetPageUptodate(page);
+			}
+			set_page_dirty(page);
+			unlock_page(page);
+			put_page(page);
+			myfs_mig_mark(mapping, index);
+			myfs_account(mapping->host);
+			cond_resched();
+		}
+	}
+	if (atomic_dec_and_test(&p->pending))
+		complete(&p->done);
+}
+
+/*
+ * Make pages [start, end) of @inode present and uptodate.  The caller
+ * holds the inode lock, at least shared, to keep truncate out.
+ */
+static int myfs_populate(struct inode *inode, pgoff_t start, pgoff_t end)
+{
+	struct myfs_populate *p;
+	unsigned int nr, i;
+	int node = NUMA_NO_NODE;
+	int error;
+
+	if (start >= end)
+		return 0;
+	nr = min_t(unsigned long, DIV_ROUND_UP(end - start, MYFS_POPULATE_CHUNK),
+		   num_online_cpus());
+	p = kzalloc(struct_size(p, works, nr), GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+	p->mapping = inode->i_mapping;
+	atomic_long_set(&p->next, start);
+	p->end = end;
+	atomic_set(&p->pending, nr);
+	init_completion(&p->done);
+
+	for (i = 0; i < nr; i++) {
+		p->works[i].p = p;
+		INIT_WORK(&p->works[i].work, myfs_populate_worker);
+	}
+	if (nr == 1) {
+		myfs_populate_worker(&p->works[0].work);
+	} else {
+		for (i = 0; i < nr; i++) {
+			node = next_node_in(node, cpuset_current_mems_allowed);
+			queue_work_node(node, myfs_populate_wq, &p->works[i].work);
+		}
+		if (wait_for_completion_killable(&p->done)) {
+			atomic_cmpxchg(&p->error, 0, -EINTR);
+			wait_for_completion(&p->done);
+		}
+	}
+	error = atomic_read(&p->error);
+	kfree(p);
+	return error;
+}
+
+static long myfs_fallocate(struct file *file, int mode, loff_t offset,
+			   loff_t len)
+{
+	struct inode *inode = file_inode(file);
+	u64 start = myfs_op_start(myfs_rw);
+	loff_t end;
+	int error;
+
+	if (mode & ~FALLOC_FL_KEEP_SIZE)
+		return -EOPNOTSUPP;
+	if (check_add_overflow(offset, len, &end))
+		return -EFBIG;
+
+	myfs_file_lock(inode, false);
+	error = inode_newsize_ok(inode, end);
+	if (error)
+		goto out;
+	error = -ENODATA;
+	if (MYFS_I(inode)->purge & MYFS_PURGED)
+		goto out;
+	error = -EPERM;
+	if ((MYFS_I(inode)->seals & F_SEAL_GROW) &&
+	    !(mode & FALLOC_FL_KEEP_SIZE) && end > i_size_read(inode))
+		goto out;
+	error = file_modified(file);
+	if (error)
+		goto out;
+	error = myfs_populate(inode, offset >> PAGE_SHIFT,
+			      DIV_ROUND_UP(end, PAGE_SIZE));
+	if (!error && !(mode & FALLOC_FL_KEEP_SIZE) && end > i_size_read(inode))
+		i_size_write(inode, end);
+out:
+	inode_unlock(inode);
+	trace_myfs_rw("fallocate", inode, offset, len, error, start);
+	return error;
+}
+
+static int myfs_fadvise(struct file *file, loff_t offset, loff_t len,
+			int advice)
+{
+	struct inode *inode = file_inode(file);
+	loff_t end;
+	int error;
+
+	if (advice != POSIX_FADV_WILLNEED)
+		return generic_fadvise(file, offset, len, advice);
+	/*
+	 * Populating fills holes, which takes space and can evict other
+	 * files; only writers may do that.  For anyone else the pages that
+	 * exist are resident already, and generic_fadvise() would fill the
+	 * holes through readahead, so there is nothing to do.
+	 */
+	if (!(file->f_mode & FMODE_WRITE))
+		return 0;
+
+	inode_lock_shared(inode);
+	end = i_size_read(inode);
+	if (len && offset < end && end - offset > len)
+		end = offset + len;
+	error = offset < end ? myfs_populate(inode, offset >> PAGE_SHIFT,
+					     DIV_ROUND_UP(end, PAGE_SIZE)) : 0;
+	inode_unlock_shared(inode);
+	return error;
+}
+
+/*
+ * Per-file TTL.  MYFS_IOC_SET_TTL on a regular file arms it to be
+ * unlinked that many seconds from now.  On a directory it sets the
+ * default TTL for files and directories created in it later.  Armed
+ * files sit in a hierarchical timer wheel per superblock: MYFS_TTL_LEVELS
+ * levels of MYFS_TTL_SLOTS slots, one second per slot at level 0 and
+ * MYFS_TTL_SLOTS times coarser at each level above.  Far-off entries
+ * cascade down a level as their slot comes round.  Arming and
+ * cancelling are O(1), and the reaper work only touches files that
+ * actually expire.  It unlinks every name of up to MYFS_TTL_BATCH files
+ * per run and requeues itself while more are due.  The clock is
+ * boottime seconds.
+ *
+ * A file is unlinked with the credentials of whoever armed it, through
+ * the mount they armed it on, so each name goes only if they could have
+ * removed it themselves (directory write permission, sticky bit, LSM).
+ */
+static struct list_head *myfs_ttl_slot(struct myfs_fs_info *fsi,
+				       time64_t expires)
+{
+	time64_t delta = expires - fsi->ttl_clk;
+	int level;
+
+	if (delta <= 0)
+		return &fsi->ttl_expired;
+	/* past the top level: park at its far end and cascade again later */
+	if (delta > MYFS_TTL_MAX)
+		expires = fsi->ttl_clk + MYFS_TTL_MAX;
+	for (level = 0; level < MYFS_TTL_LEVELS - 1; level++)
+		if (delta < (1LL << (MYFS_TTL_BITS * (level + 1))))
+			break;
+	return &fsi->ttl_wheel[level][(expires >> (MYFS_TTL_BITS * level)) &
+				      (MYFS_TTL_SLOTS - 1)];
+}
+
+/* Move the wheel's clock up to @now, collecting what expires. */
+static void myfs_ttl_advance(struct myfs_fs_info *fsi, time64_t now)
+{
+	struct myfs_inode_info *mi, *tmp;
+	LIST_HEAD(cascade);
+	int level, i;
+
+	if (!fsi->ttl_nr) {
+		fsi->ttl_clk = now;
+		return;
+	}
+	if (now - fsi->ttl_clk > MYFS_TTL_SLOTS) {
+		/* suspended or frozen for a while: re-slot rather than step */
+		for (level = 0; level < MYFS_TTL_LEVELS; level++)
+			for (i = 0; i < MYFS_TTL_SLOTS; i++)
+				list_splice_init(&fsi->ttl_wheel[level][i], &cascade);
+		fsi->ttl_clk = now;
+		list_for_each_entry_safe(mi, tmp, &cascade, ttl_node)
+			list_move_tail(&mi->ttl_node, myfs_ttl_slot(fsi, mi->expires));
+		return;
+	}
+	while (fsi->ttl_clk < now) {
+		time64_t clk = ++fsi->ttl_clk;
+
+		for (level = MYFS_TTL_LEVELS - 1; level > 0; level--) {
+			if (clk & ((1LL << (MYFS_TTL_BITS * level)) - 1))
+				continue;
+			list_splice_init(&fsi->ttl_wheel[level][(clk >> (MYFS_TTL_BITS * level)) &
+								 (MYFS_TTL_SLOTS - 1)],
+					 &cascade);
+			list_for_each_entry_safe(mi, tmp, &cascade, ttl_node)
+				list_move_tail(&mi->ttl_node,
+					       myfs_ttl_slot(fsi, mi->expires));
+		}
+		list_splice_tail_init(&fsi->ttl_wheel[0][clk & (MYFS_TTL_SLOTS - 1)],
+				      &fsi->ttl_expired);
+	}
+}
+
+static void myfs_ttl_kick(struct myfs_fs_info *fsi)
+{
+	lockdep_assert_held(&fsi->ttl_lock);
+	if (!list_empty(&fsi->ttl_expired))
+		mod_delayed_work(system_unbound_wq, &fsi->ttl_work, 0);
+	else if (fsi->ttl_nr)
+		queue_delayed_work(system_unbound_wq, &fsi->ttl_work,
+				   round_jiffies_relative(HZ));
+}
+
+static void myfs_ttl_put_cred(const struct cred *cred,
+			      struct user_namespace *userns)
+{
+	if (cred) {
+		put_cred(cred);
+		put_user_ns(userns);
+	}
+}
+
+/*
+ * Arm @inode to expire @ttl seconds from now, on behalf of the current
+ * task through @mnt_userns, or disarm it if @ttl is 0.
+ */
+static void myfs_ttl_arm(struct inode *inode, u64 ttl,
+			 struct user_namespace *mnt_userns)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	time64_t now = ktime_get_boottime_seconds();
+	const struct cred *cred = NULL;
+
+	if (ttl) {
+		cred = get_current_cred();
+		mnt_userns = get_user_ns(mnt_userns);
+	} else {
+		mnt_userns = NULL;
+	}
+	spin_lock(&fsi->ttl_lock);
+	myfs_ttl_advance(fsi, now);
+	if (!list_empty(&mi->ttl_node)) {
+		list_del_init(&mi->ttl_node);
+		fsi->ttl_nr--;
+	}
+	swap(mi->ttl_cred, cred);
+	swap(mi->ttl_userns, mnt_userns);
+	mi->expires = 0;
+	if (ttl) {
+		mi->expires = now + min_t(u64, ttl, TIME64_MAX - now);
+		list_add_tail(&mi->ttl_node, myfs_ttl_slot(fsi, mi->expires));
+		fsi->ttl_nr++;
+		myfs_ttl_kick(fsi);
+	}
+	spin_unlock(&fsi->ttl_lock);
+	myfs_ttl_put_cred(cred, mnt_userns);
+}
+
+/* On eviction; nobody else can arm or reap @inode by now. */
+static void myfs_ttl_cancel(struct inode *inode)
+{
+	struct myfs_fs_info *fsi = inode->i_sb->s_fs_info;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+
+	myfs_ttl_put_cred(mi->ttl_cred, mi->ttl_userns);
+	mi->ttl_cred = NULL;
+	mi->ttl_userns = NULL;
+	if (list_empty_careful(&mi->ttl_node))
+		return;
+	spin_lock(&fsi->ttl_lock);
+	if (!list_empty(&mi->ttl_node)) {
+		list_del_init(&mi->ttl_node);
+		fsi->ttl_nr--;
+	}
+	spin_unlock(&fsi->ttl_lock);
+}
+
+/*
+ * Unlink every name of @inode as @cred; returns false if one could not
+ * be.  vfs_unlink() does the may_delete() checks against @cred.
+ */
+static bool myfs_ttl_reap(struct inode *inode, const struct cred *cred,
+			  struct user_namespace *mnt_userns)
+{
+	struct dentry *dentry, *parent;
+	const struct cred *old;
+	int error = 0;
+
+	old = override_creds(cred);
+	while (!error && (dentry = d_find_alias(inode))) {
+		parent = dget_parent(dentry);
+		inode_lock_nested(d_inode(parent), I_MUTEX_PARENT);
+		if (dentry->d_parent == parent && d_inode(dentry) == inode &&
+		    !d_unhashed(dentry))
+			error = vfs_unlink(mnt_userns, d_inode(parent),
+					   dentry, NULL);
+		else
+			error = -ENOENT;
+		inode_unlock(d_inode(parent));
+		dput(parent);
+		dput(dentry);
+	}
+	revert_creds(old);
+	return !error;
+}
+
+static void myfs_ttl_work(struct work_struct *work)
+{
+	struct myfs_fs_info *fsi = container_of(to_delayed_work(work),
+						struct myfs_fs_info, ttl_work);
+	struct {
+		struct inode		*inode;
+		const struct cred	*cred;
+		struct user_namespace	*userns;
+	} batch[MYFS_TTL_BATCH];
+	struct myfs_inode_info *mi;
+	unsigned int nr = 0, reaped = 0, i;
+
+	/* myfs_unfreeze_fs() kicks us again */
+	if (READ_ONCE(fsi->frozen))
+		return;
+	if (!sb_start_write_trylock(fsi->sb)) {
+		/* being frozen, or a freeze that may yet fail */
+		queue_delayed_work(system_unbound_wq, &fsi->ttl_work, HZ);
+		return;
+	}
+
+	spin_lock(&fsi->ttl_lock);
+	myfs_ttl_advance(fsi, ktime_get_boottime_seconds());
+	while (nr < MYFS_TTL_BATCH && !list_empty(&fsi->ttl_expired)) {
+		mi = list_first_entry(&fsi->ttl_expired, struct myfs_inode_info,
+				      ttl_node);
+		list_del_init(&mi->ttl_node);
+		fsi->ttl_nr--;
+		fsi->ttl_expired_total++;
+		/* NULL if it is being evicted anyway */
+		batch[nr].inode = igrab(&mi->vfs_inode);
+		if (!batch[nr].inode)
+			continue;
+		/* disarmed now, so the arming credentials are ours */
+		batch[nr].cred = mi->ttl_cred;
+		batch[nr].userns = mi->ttl_userns;
+		mi->ttl_cred = NULL;
+		mi->ttl_userns = NULL;
+		nr++;
+	}
+	spin_unlock(&fsi->ttl_lock);
+
+	for (i = 0; i < nr; i++) {
+		/* re-armed since it was taken off the wheel? */
+		if (list_empty_careful(&MYFS_I(batch[i].inode)->ttl_node) &&
+		    myfs_ttl_reap(batch[i].inode, batch[i].cred,
+				  batch[i].userns))
+			reaped++;
+	}
+	sb_end_write(fsi->sb);
+	for (i = 0; i < nr; i++) {
+		iput(batch[i].inode);
+		myfs_ttl_put_cred(batch[i].cred, batch[i].userns);
+	}
+
+	spin_lock(&fsi->ttl_lock);
+	fsi->ttl_reaped += reaped;
+	fsi->ttl_failed += nr - reaped;
+	myfs_ttl_kick(fsi);
+	spin_unlock(&fsi->ttl_lock);
+}
+
+static void myfs_ttl_init(struct myfs_fs_info *fsi)
+{
+	int level, slot;
+
+	spin_lock_init(&fsi->ttl_lock);
+	for (level = 0; level < MYFS_TTL_LEVELS; level++)
+		for (slot = 0; slot < MYFS_TTL_SLOTS; slot++)
+			INIT_LIST_HEAD(&fsi->ttl_wheel[level][slot]);
+	INIT_LIST_HEAD(&fsi->ttl_expired);
+	fsi->ttl_clk = ktime_get_boottime_seconds();
+	INIT_DELAYED_WORK(&fsi->ttl_work, myfs_ttl_work);
+}
+
+static long myfs_ioc_ttl(struct file *file, unsigned int cmd,
+			 u64 __user *argp)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	time64_t expires;
+	u64 ttl;
+
+	if (!S_ISREG(inode->i_mode) && !S_ISDIR(inode->i_mode))
+		return -EINVAL;
+	if (cmd == MYFS_IOC_GET_TTL) {
+		if (S_ISDIR(inode->i_mode))
+			return put_user(READ_ONCE(mi->ttl), argp);
+		expires = READ_ONCE(mi->expires);
+		ttl = expires ? max_t(time64_t, expires -
+				      ktime_get_boottime_seconds(), 0) : 0;
+		return put_user(ttl, argp);
+	}
+
+	if (!inode_owner_or_capable(file_mnt_user_ns(file), inode))
+		return -EPERM;
+	if (get_user(ttl, argp))
+		return -EFAULT;
+	if (S_ISDIR(inode->i_mode))
+		WRITE_ONCE(mi->ttl, ttl);
+	else
+		myfs_ttl_arm(inode, ttl, file_mnt_user_ns(file));
+	return 0;
+}
+
+/*
+ * Block device export (MYFS_IOC_BLKDEV_ADD/DEL).  A myfsbN disk uses the
+ * page cache of a myfs file as its storage: every request is copied
+ * once, page by page, between the bio and the file's pages, the way brd
+ * does with its own pages.  There is no loop-style worker or second
+ * trip through the VFS, and each CPU gets a hardware queue.  The disk
+ * pins the file (and so the mount) until it is deleted, and the file
+ * keeps its size while it is attached.
+ */
+struct myfs_blkdev {
+	struct file		*file;
+	struct gendisk		*disk;
+	struct blk_mq_tag_set	tag_set;
+	int			index;
+};
+
+static int myfs_blkdev_major;
+static DEFINE_IDA(myfs_blkdev_ida);
+
+static int myfs_bdev_copy(struct myfs_blkdev *dev, struct page *page,
+			  unsigned int len, unsigned int off, loff_t pos,
+			  bool write)
+{
+	struct address_space *mapping = dev->file->f_mapping;
+	/* we may be under writeback of a filesystem on this disk */
+	gfp_t gfp = mapping_gfp_mask(mapping) & ~(__GFP_IO | __GFP_FS);
+
+	while (len) {
+		unsigned int poff = offset_in_page(pos);
+		unsigned int n = min_t(unsigned int, len, PAGE_SIZE - poff);
+		struct page *fpage;
+		int error;
+
+		if (write) {
+			error = myfs_reserve_page(mapping->host, pos >> PAGE_SHIFT);
+			if (error)
+				return error;
+			fpage = find_or_create_page(mapping, pos >> PAGE_SHIFT, gfp);
+			if (!fpage)
+				return -ENOMEM;
+			if (!PageUptodate(fpage)) {
+				clear_highpage(fpage);
+				SetPageUptodate(fpage);
+			}
+			memcpy_page(fpage, poff, page, off, n);
+			flush_dcache_page(fpage);
+			set_page_dirty(fpage);
+			unlock_page(fpage);
+			myfs_mig_mark(mapping, pos >> PAGE_SHIFT);
+		} else {
+			fpage = find_get_page(mapping, pos >> PAGE_SHIFT);
+			if (fpage && PageUptodate(fpage))
+				memcpy_page(page, off, fpage, poff, n);
+			else
+				memzero_page(page, off, n);
+		}
+		if (fpage)
+			put_page(fpage);
+		pos += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static blk_status_t myfs_bdev_queue_rq(struct blk_mq_hw_ctx *hctx,
+				       const struct blk_mq_queue_data *bd)
+{
+	struct request *rq = bd->rq;
+	struct myfs_blkdev *dev = rq->q->queuedata;
+	struct inode *inode = file_inode(dev->file);
+	loff_t pos = (loff_t)blk_rq_pos(rq) << SECTOR_SHIFT;
+	bool write = op_is_write(req_op(rq));
+	blk_status_t status = BLK_STS_OK;
+	struct req_iterator iter;
+	struct bio_vec bvec;
+	int error;
+
+	blk_mq_start_request(rq);
+	switch (req_op(rq)) {
+	case REQ_OP_FLUSH:
+		break;
+	case REQ_OP_READ:
+	case REQ_OP_WRITE:
+		/* freezing the mount freezes its disks (BLK_MQ_F_BLOCKING) */
+		if (write)
+			sb_start_write(inode->i_sb);
+		rq_for_each_segment(bvec, rq, iter) {
+			error = myfs_bdev_copy(dev, bvec.bv_page, bvec.bv_len,
+					       bvec.bv_offset, pos, write);
+			if (error) {
+				status = errno_to_blk_status(error);
+				break;
+			}
+			pos += bvec.bv_len;
+		}
+		if (write) {
+			myfs_account(inode);
+			sb_end_write(inode->i_sb);
+		}
+		break;
+	default:
+		status = BLK_STS_NOTSUPP;
+		break;
+	}
+	blk_mq_end_request(rq, status);
+	return BLK_STS_OK;
+}
+
+static const struct blk_mq_ops myfs_bdev_mq_ops = {
+	.queue_rq	= myfs_bdev_queue_rq,
+};
+
+static const struct block_device_operations myfs_bdev_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static int myfs_blkdev_add(struct file *file, u32 __user *argp)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	struct myfs_blkdev *dev;
+	struct gendisk *disk;
+	loff_t size;
+	int error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+	dev->index = ida_alloc_max(&myfs_blkdev_ida, MINORMASK, GFP_KERNEL);
+	if (dev->index < 0) {
+		error = dev->index;
+		goto out_free;
+	}
+	dev->tag_set.ops = &myfs_bdev_mq_ops;
+	dev->tag_set.nr_hw_queues = num_online_cpus();
+	dev->tag_set.queue_depth = 128;
+	dev->tag_set.numa_node = NUMA_NO_NODE;
+	dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+	error = blk_mq_alloc_tag_set(&dev->tag_set);
+	if (error)
+		goto out_ida;
+	disk = blk_mq_alloc_disk(&dev->tag_set, dev);
+	if (IS_ERR(disk)) {
+		error = PTR_ERR(disk);
+		goto out_tags;
+	}
+	dev->disk = disk;
+	disk->major = myfs_blkdev_major;
+	disk->first_minor = dev->index;
+	disk->minors = 1;
+	disk->fops = &myfs_bdev_fops;
+	disk->private_data = dev;
+	snprintf(disk->disk_name, DISK_NAME_LEN, "myfsb%d", dev->index);
+	blk_queue_physical_block_size(disk->queue, PAGE_SIZE);
+	blk_queue_flag_set(QUEUE_FLAG_NONROT, disk->queue);
+	blk_queue_flag_clear(QUEUE_FLAG_ADD_RANDOM, disk->queue);
+
+	inode_lock(inode);
+	error = -EBUSY;
+	if (mi->blkdev)
+		goto out_unlock;
+	if (mi->purge)
+		goto out_unlock;
+	size = i_size_read(inode);
+	error = -EINVAL;
+	if (!size || (size & (SECTOR_SIZE - 1)))
+		goto out_unlock;
+	set_capacity(disk, size >> SECTOR_SHIFT);
+	if (!(file->f_mode & FMODE_WRITE) ||
+	    (mi->seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)))
+		set_disk_ro(disk, true);
+	dev->file = get_file(file);
+	error = add_disk(disk);
+	if (error) {
+		fput(dev->file);
+		goto out_unlock;
+	}
+	mi->blkdev = dev;
+	inode_unlock(inode);
+	return put_user(dev->index, argp);
+
+out_unlock:
+	inode_unlock(inode);
+	blk_cleanup_disk(disk);
+out_tags:
+	blk_mq_free_tag_set(&dev->tag_set);
+out_ida:
+	ida_free(&myfs_blkdev_ida, dev->index);
+out_free:
+	kfree(dev);
+	return error;
+}
+
+static int myfs_blkdev_del(struct file *file)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_blkdev *dev;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	inode_lock(inode);
+	dev = MYFS_I(inode)->blkdev;
+	MYFS_I(inode)->blkdev = NULL;
+	inode_unlock(inode);
+	if (!dev)
+		return -ENXIO;
+
+	del_gendisk(dev->disk);
+	blk_cleanup_disk(dev->disk);
+	blk_mq_free_tag_set(&dev->tag_set);
+	ida_free(&myfs_blkdev_ida, dev->index);
+	fput(dev->file);
+	kfree(dev);
+	return 0;
+}
+
+/*
+ * File sealing, as memfd does it for shmem.  fcntl(F_ADD_SEALS) only
+ * knows about shmem and hugetlbfs, so myfs takes the same F_SEAL_* bits
+ * through MYFS_IOC_ADD_SEALS and MYFS_IOC_GET_SEALS.
+ */
+#define MYFS_SEALS	(F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | \
+			 F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)
+
+static int myfs_add_seals(struct file *file, unsigned int seals)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	int error;
+
+	if (seals & ~MYFS_SEALS)
+		return -EINVAL;
+	if (!(file->f_mode & FMODE_WRITE))
+		return -EPERM;
+
+	inode_lock(inode);
+	error = -EPERM;
+	if (mi->seals & F_SEAL_SEAL)
+		goto out;
+	/* a read-write disk would keep writing past either seal */
+	error = -EBUSY;
+	if ((seals & ~mi->seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) &&
+	    mi->blkdev && !get_disk_ro(mi->blkdev->disk))
+		goto out;
+	if ((seals & F_SEAL_WRITE) && !(mi->seals & F_SEAL_WRITE)) {
+		error = mapping_deny_writable(file->f_mapping);
+		if (error)
+			goto out;
+	}
+	WRITE_ONCE(mi->seals, mi->seals | seals);
+	error = 0;
+out:
+	inode_unlock(inode);
+	return error;
+}
+
+/*
+ * MYFS_IOC_XCHG_RANGE: swap the pages of two ranges between two files
+ * without copying.  Both inodes and both invalidate locks are held, so
+ * writes, truncation and faults see the exchange all at once; read()
+ * takes no lock and may see it page by page.  The first pass fills a
+ * hole opposite a page with zeros and fails on pages pinned for I/O,
+ * so that the second pass, which unmaps each pair and swaps them with
+ * three replace_page_cache_page() calls through a placeholder page,
+ * cannot fail half way.
+ */
+static int myfs_xchg_check(struct file *file, struct inode *inode)
+{
+	struct myfs_inode_info *mi = MYFS_I(inode);
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+	if ((file->f_mode & (FMODE_READ | FMODE_WRITE)) !=
+	    (FMODE_READ | FMODE_WRITE))
+		return -EBADF;
+	if (IS_APPEND(inode) || IS_IMMUTABLE(inode))
+		return -EPERM;
+	if (mi->seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))
+		return -EPERM;
+	if (mi->blkdev || mi->purge)
+		return -EBUSY;
+	return 0;
+}
+
+static bool myfs_xchg_resize_ok(struct inode *inode, loff_t size)
+{
+	unsigned int seals = MYFS_I(inode)->seals;
+	loff_t old = i_size_read(inode);
+
+	return !((size > old && (seals & F_SEAL_GROW)) ||
+		 (size < old && (seals & F_SEAL_SHRINK)));
+}
+
+static bool myfs_xchg_present(struct address_space *mapping, pgoff_t index)
+{
+	struct page *page = find_get_page(mapping, index);
+
+	if (page)
+		put_page(page);
+	return page != NULL;
+}
+
+/* Make page @index of @mapping present, zero-filled if it was a hole. */
+static int myfs_xchg_fill(struct address_space *mapping, pgoff_t index)
+{
+	struct page *page;
+	int error;
+
+	error = myfs_reserve_page(mapping->host, index);
+	if (error)
+		return error;
+	page = myfs_grab_page(mapping, index);
+	if (!page)
+		return -ENOMEM;
+	if (!PageUptodate(page)) {
+		clear_highpage(page);
+		flush_dcache_page(page);
+		SetPageUptodate(page);
+		set_page_dirty(page);
+	}
+	if (page_maybe_dma_pinned(page))
+		error = -EBUSY;
+	unlock_page(page);
+	put_page(page);
+	return error;
+}
+
+static int myfs_xchg_prepare(struct address_space *m1, pgoff_t idx1,
+			     struct address_space *m2, pgoff_t idx2,
+			     pgoff_t nr)
+{
+	pgoff_t i;
+	int error = 0;
+
+	for (i = 0; i < nr && !error; i++) {
+		if (!myfs_xchg_present(m1, idx1 + i) &&
+		    !myfs_xchg_present(m2, idx2 + i))
+			continue;
+		error = myfs_xchg_fill(m1, idx1 + i);
+		if (!error)
+			error = myfs_xchg_fill(m2, idx2 + i);
+		if (!error && fatal_signal_pending(current))
+			error = -EINTR;
+		cond_resched();
+	}
+	myfs_account(m1->host);
+	myfs_account(m2->host);
+	return error;
+}
+
+/* Swap m1[i1] and m2[i2] through @tmp, which is locked and in no mapping. */
+static void myfs_xchg_page(struct address_space *m1, pgoff_t i1,
+			   struct address_space *m2, pgoff_t i2,
+			   struct page *tmp)
+{
+	struct page *p1, *p2;
+
+	p1 = find_lock_page(m1, i1);
+	p2 = find_lock_page(m2, i2);
+	/* myfs_xchg_prepare() left both or neither */
+	if (WARN_ON_ONCE(!p1 != !p2) || !p1)
+		goto out;
+	unmap_mapping_range(m1, (loff_t)i1 << PAGE_SHIFT, PAGE_SIZE, 0);
+	unmap_mapping_range(m2, (loff_t)i2 << PAGE_SHIFT, PAGE_SIZE, 0);
+	replace_page_cache_page(p1, tmp);
+	replace_page_cache_page(p2, p1);
+	replace_page_cache_page(tmp, p2);
+	myfs_mig_mark(m1, i1);
+	myfs_mig_mark(m2, i2);
+out:
+	if (p2) {
+		unlock_page(p2);
+		put_page(p2);
+	}
+	if (p1) {
+		unlock_page(p1);
+		put_page(p1);
+	}
+}
+
+static long myfs_ioc_xchg_range(struct file *file1,
+				struct myfs_xchg_range __user *argp)
+{
+	struct inode *inode1 = file_inode(file1), *inode2;
+	struct address_space *m1, *m2;
+	struct myfs_xchg_range x;
+	loff_t size1, size2, end1, end2;
+	pgoff_t idx1, idx2, nr, i;
+	struct page *tmp;
+	struct fd f2;
+	bool full;
+	long error;
+
+	if (copy_from_user(&x, argp, sizeof(x)))
+		return -EFAULT;
+	if (x.flags & ~MYFS_XCHG_FULL)
+		return -EINVAL;
+	full = x.flags & MYFS_XCHG_FULL;
+	if (full ? (x.offset1 | x.offset2 | x.length) :
+		   !PAGE_ALIGNED(x.offset1 | x.offset2 | x.length))
+		return -EINVAL;
+
+	f2 = fdget(x.fd);
+	if (!f2.file)
+		return -EBADF;
+	inode2 = file_inode(f2.file);
+	m1 = inode1->i_mapping;
+	m2 = inode2->i_mapping;
+	error = -EXDEV;
+	if (f2.file->f_path.mnt != file1->f_path.mnt)
+		goto out_fd;
+	error = -EINVAL;
+	if (inode1 == inode2)
+		goto out_fd;
+	tmp = alloc_page(GFP_KERNEL);
+	error = -ENOMEM;
+	if (!tmp)
+		goto out_fd;
+	error = mnt_want_write_file(file1);
+	if (error)
+		goto out_tmp;
+
+	lock_two_nondirectories(inode1, inode2);
+	filemap_invalidate_lock_two(m1, m2);
+	error = myfs_xchg_check(file1, inode1);
+	if (!error)
+		error = myfs_xchg_check(f2.file, inode2);
+	if (error)
+		goto out_unlock;
+
+	size1 = i_size_read(inode1);
+	size2 = i_size_read(inode2);
+	if (full) {
+		error = -EPERM;
+		if (!myfs_xchg_resize_ok(inode1, size2) ||
+		    !myfs_xchg_resize_ok(inode2, size1))
+			goto out_unlock;
+		idx1 = idx2 = 0;
+		nr = DIV_ROUND_UP(max(size1, size2), PAGE_SIZE);
+	} else {
+		end1 = round_up(size1, PAGE_SIZE);
+		end2 = round_up(size2, PAGE_SIZE);
+		error = -EINVAL;
+		if (x.length > end1 || x.offset1 > end1 - x.length ||
+		    x.length > end2 || x.offset2 > end2 - x.length)
+			goto out_unlock;
+		idx1 = x.offset1 >> PAGE_SHIFT;
+		idx2 = x.offset2 >> PAGE_SHIFT;
+		nr = x.length >> PAGE_SHIFT;
+	}
+
+	error = file_modified(file1);
+	if (!error)
+		error = file_modified(f2.file);
+	if (!error)
+		error = myfs_xchg_prepare(m1, idx1, m2, idx2, nr);
+	if (error)
+		goto out_unlock;
+
+	lock_page(tmp);
+	for (i = 0; i < nr; i++) {
+		myfs_xchg_page(m1, idx1 + i, m2, idx2 + i, tmp);
+		cond_resched();
+	}
+	unlock_page(tmp);
+	if (full) {
+		i_size_write(inode1, size2);
+		i_size_write(inode2, size1);
+		if (size2 < MYFS_I(inode1)->mig_trunc)
+			MYFS_I(inode1)->mig_trunc = size2;
+		if (size1 < MYFS_I(inode2)->mig_trunc)
+			MYFS_I(inode2)->mig_trunc = size1;
+	}
+	error = 0;
+out_unlock:
+	filemap_invalidate_unlock_two(m1, m2);
+	unlock_two_nondirectories(inode1, inode2);
+	mnt_drop_write_file(file1);
+out_tmp:
+	put_page(tmp);
+out_fd:
+	fdput(f2);
+	return error;
+}
+
+static long myfs_file_ioctl(struct file *file, unsigned int cmd,
+			    unsigned long arg)
+{
+	unsigned int __user *argp = (unsigned int __user *)arg;
+	unsigned int seals;
+
+	switch (cmd) {
+	case MYFS_IOC_ADD_SEALS:
+		if (get_user(seals, argp))
+			return -EFAULT;
+		return myfs_add_seals(file, seals);
+	case MYFS_IOC_GET_SEALS:
+		seals = READ_ONCE(MYFS_I(file_inode(file))->seals);
+		return put_user(seals, argp);
+	case MYFS_IOC_BLKDEV_ADD:
+		return myfs_blkdev_add(file, argp);
+	case MYFS_IOC_BLKDEV_DEL:
+		return myfs_blkdev_del(file);
+	case MYFS_IOC_SET_TTL:
+	case MYFS_IOC_GET_TTL:
+		return myfs_ioc_ttl(file, cmd, (u64 __user *)arg);
+	case MYFS_IOC_SET_LRU_PIN:
+	case MYFS_IOC_GET_LRU_PIN:
+		return myfs_ioc_lru_pin(file, cmd, argp);
+	case MYFS_IOC_PURGE_UNPIN:
+	case MYFS_IOC_PURGE_PIN:
+		return myfs_ioc_purge(file, cmd);
+	case MYFS_IOC_SET_UNTORN:
+	case MYFS_IOC_GET_UNTORN:
+		return myfs_ioc_untorn(file, cmd, (void __user *)arg);
+	case MYFS_IOC_XCHG_RANGE:
+		return myfs_ioc_xchg_range(file,
+				(struct myfs_xchg_range __user *)arg);
+	}
+	return -ENOTTY;
+}
+
+static unsigned long myfs_mmu_get_unmapped_area(struct file *file,
+		unsigned long addr, unsigned long len, unsigned long pgoff,
+		unsigned long flags)
+{
+	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+}
+
+const struct file_operations myfs_file_operations = {
+	.read_iter	= myfs_file_read_iter,
+	.write_iter	= myfs_file_write_iter,
+	.mmap		= myfs_file_mmap,
+	.fsync		= noop_fsync,
+	.splice_read	= generic_file_splice_read,
+	.splice_write	= iter_file_splice_write,
+	.llseek		= generic_file_llseek,
+	.fallocate	= myfs_fallocate,
+	.fadvise	= myfs_fadvise,
+	.unlocked_ioctl	= myfs_file_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.get_unmapped_area	= myfs_mmu_get_unmapped_area,
+};
+
+static int myfs_setattr(struct user_namespace *mnt_userns,
+			struct dentry *dentry, struct iattr *iattr)
+{
+	struct inode *inode = d_inode(dentry);
+	u64 start = myfs_op_start(myfs_rw);
+	int error;
+
+	/* not the privilege stripping a write does on the caller's behalf */
+	if (iattr->ia_valid & ~(ATTR_FORCE | ATTR_KILL_SUID | ATTR_KILL_SGID |
+				ATTR_KILL_PRIV)) {
+		error = myfs_qos_charge_locked(inode->i_sb);
+		if (error)
+			return error;
+	}
+	if (iattr->ia_valid & ATTR_SIZE) {
+		unsigned int seals = MYFS_I(inode)->seals;
+
+		if (MYFS_I(inode)->blkdev)
+			return -EBUSY;
+		if ((seals & F_SEAL_SHRINK) && iattr->ia_size < inode->i_size)
+			return -EPERM;
+		if ((seals & F_SEAL_GROW) && iattr->ia_size > inode->i_size)
+			return -EPERM;
+		if (iattr->ia_size < MYFS_I(inode)->mig_trunc)
+			MYFS_I(inode)->mig_trunc = iattr->ia_size;
+	}
+	error = simple_setattr(mnt_userns, dentry, iattr);
+	if (iattr->ia_valid & ATTR_SIZE) {
+		myfs_account(inode);
+		trace_myfs_rw("truncate", inode, iattr->ia_size, 0, error, start);
+	}
+	return error;
+}
+
+/*
+ * Extended attributes (user., trusted., security.).  Each inode has an
+ * RCU-protected hash table of entries, allocated on first use and
+ * doubled when it holds as many entries as buckets.  An entry carries
+ * its name and value in the same allocation.  getxattr and listxattr
+ * only take rcu_read_lock().  Writers run under the inode lock (or on
+ * an inode nobody else can see yet).  They replace entries with
+ * hlist_replace_rcu().  Growing copies every entry into the new table
+ * and frees the old one after a grace period.
+ */
+#define MYFS_XATTR_MIN_BITS	2
+
+struct myfs_xattr {
+	struct hlist_node	node;
+	struct rcu_head		rcu;
+	u32			hash;
+	u32			name_len;	/* full name, without the NUL */
+	u32			size;
+	char			data[];		/* name, NUL, value */
+};
+
+struct myfs_xattrs {
+	struct rcu_head		rcu;
+	unsigned int		bits;
+	unsigned int		count;
+	size_t			names_len;	/* listxattr() size */
+	struct hlist_head	buckets[];
+};
+
+static struct myfs_xattr *myfs_xattr_find(struct myfs_xattrs *t,
+					  const char *name, size_t len, u32 hash)
+{
+	struct myfs_xattr *x;
+
+	hlist_for_each_entry_rcu(x, &t->buckets[hash_32(hash, t->bits)], node,
+				 true)
+		if (x->hash == hash && x->name_len == len &&
+		    !memcmp(x->data, name, len))
+			return x;
+	return NULL;
+}
+
+static void myfs_xattrs_free(struct myfs_xattrs *t)
+{
+	struct myfs_xattr *x;
+	struct hlist_node *n;
+	unsigned int i;
+
+	if (!t)
+		return;
+	for (i = 0; i < (1U << t->bits); i++)
+		hlist_for_each_entry_safe(x, n, &t->buckets[i], node)
+			kfree(x);
+	kfree(t);
+}
+
+static void myfs_xattrs_free_rcu(struct rcu_head *head)
+{
+	myfs_xattrs_free(container_of(head, struct myfs_xattrs, rcu));
+}
+
+static struct myfs_xattrs *myfs_xattrs_grow(struct myfs_inode_info *mi,
+					    struct myfs_xattrs *old)
+{
+	unsigned int bits = old ? old->bits + 1 : MYFS_XATTR_MIN_BITS;
+	struct myfs_xattrs *t;
+	struct myfs_xattr *x, *copy;
+	unsigned int i;
+
+	t = kzalloc(struct_size(t, buckets, 1U << bits), GFP_KERNEL_ACCOUNT);
+	if (!t)
+		return ERR_PTR(-ENOMEM);
+	t->bits = bits;
+	if (old) {
+		for (i = 0; i < (1U << old->bits); i++) {
+			hlist_for_each_entry(x, &old->buckets[i], node) {
+				copy = kmemdup(x, struct_size(x, data, x->name_len + 1 + x->size),
+					       GFP_KERNEL_ACCOUNT);
+				if (!copy) {
+					myfs_xattrs_free(t);
+					return ERR_PTR(-ENOMEM);
+				}
+				hlist_add_head(&copy->node,
+					       &t->buckets[hash_32(copy->hash, bits)]);
+			}
+		}
+		t->count = old->count;
+		t->names_len = old->names_len;
+	}
+	rcu_assign_pointer(mi->xattrs, t);
+	if (old)
+		call_rcu(&old->rcu, myfs_xattrs_free_rcu);
+	return t;
+}
+
+/* Set, replace or (with a NULL @value) remove the xattr @name. */
+static int myfs_xattr_store(struct inode *inode, const char *name,
+			    const void *value, size_t size, int flags)
+{
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	struct myfs_xattrs *t = rcu_dereference_protected(mi->xattrs, true);
+	size_t len = strlen(name);
+	u32 hash = full_name_hash(NULL, name, len);
+	struct myfs_xattr *old, *x;
+
+	old = t ? myfs_xattr_find(t, name, len, hash) : NULL;
+	if (old && (flags & XATTR_CREATE))
+		return -EEXIST;
+	if (!old && (flags & XATTR_REPLACE))
+		return -ENODATA;
+
+	if (!value) {
+		if (!old)
+			return -ENODATA;
+		hlist_del_rcu(&old->node);
+		t->count--;
+		t->names_len -= old->name_len + 1;
+		kfree_rcu(old, rcu);
+		goto out;
+	}
+
+	x = kmalloc(struct_size(x, data, len + 1 + size), GFP_KERNEL_ACCOUNT);
+	if (!x)
+		return -ENOMEM;
+	x->hash = hash;
+	x->name_len = len;
+	x->size = size;
+	memcpy(x->data, name, len + 1);
+	memcpy(x->data + len + 1, value, size);
+
+	if (old) {
+		hlist_replace_rcu(&old->node, &x->node);
+		kfree_rcu(old, rcu);
+		goto out;
+	}
+	if (!t || t->count >= (1U << t->bits)) {
+		t = myfs_xattrs_grow(mi, t);
+		if (IS_ERR(t)) {
+			kfree(x);
+			return PTR_ERR(t);
+		}
+	}
+	hlist_add_head_rcu(&x->node, &t->buckets[hash_32(hash, t->bits)]);
+	t->count++;
+	t->names_len += len + 1;
+out:
+	inode->i_ctime = current_time(inode);
+	return 0;
+}
+
+static int myfs_xattr_get(const struct xattr_handler *handler,
+			  struct dentry *unused, struct inode *inode,
+			  const char *name, void *buffer, size_t size)
+{
+	struct myfs_xattrs *t;
+	struct myfs_xattr *x;
+	size_t len;
+	int ret = -ENODATA;
+
+	name = xattr_full_name(handler, name);
+	len = strlen(name);
+	rcu_read_lock();
+	t = rcu_dereference(MYFS_I(inode)->xattrs);
+	x = t ? myfs_xattr_find(t, name, len, full_name_hash(NULL, name, len))
+	      : NULL;
+	if (x) {
+		ret = x->size;
+		if (size && size < x->size)
+			ret = -ERANGE;
+		else if (size)
+			memcpy(buffer, x->data + x->name_len + 1, x->size);
+	}
+	rcu_read_unlock();
+	return ret;
+}
+
+static int myfs_xattr_set(const struct xattr_handler *handler,
+			  struct user_namespace *mnt_userns,
+			  struct dentry *unused, struct inode *inode,
+			  const char *name, const void *value, size_t size,
+			  int flags)
+{
+	return myfs_xattr_store(inode, xattr_full_name(handler, name),
+				value, size, flags);
+}
+
+static ssize_t myfs_listxattr(struct dentry *dentry, char *buffer, size_t size)
+{
+	bool trusted = capable(CAP_SYS_ADMIN);
+	struct myfs_xattrs *t;
+	struct myfs_xattr *x;
+	ssize_t ret = 0;
+	unsigned int i;
+
+	rcu_read_lock();
+	t = rcu_dereference(MYFS_I(d_inode(dentry))->xattrs);
+	if (!t)
+		goto out;
+	if (trusted && !buffer) {
+		ret = t->names_len;
+		goto out;
+	}
+	for (i = 0; i < (1U << t->bits); i++) {
+		hlist_for_each_entry_rcu(x, &t->buckets[i], node) {
+			size_t len = x->name_len + 1;
+
+			if (!trusted && !strncmp(x->data, XATTR_TRUSTED_PREFIX,
+						 XATTR_TRUSTED_PREFIX_LEN))
+				continue;
+			if (buffer) {
+				if (size < len) {
+					ret = -ERANGE;
+					goto out;
+				}
+				memcpy(buffer, x->data, len);
+				buffer += len;
+				size -= len;
+			}
+			ret += len;
+		}
+	}
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+static const struct xattr_handler myfs_user_xattr_handler = {
+	.prefix	= XATTR_USER_PREFIX,
+	.get	= myfs_xattr_get,
+	.set	= myfs_xattr_set,
+};
+
+static const struct xattr_handler myfs_trusted_xattr_handler = {
+	.prefix	= XATTR_TRUSTED_PREFIX,
+	.get	= myfs_xattr_get,
+	.set	= myfs_xattr_set,
+};
+
+static const struct xattr_handler myfs_security_xattr_handler = {
+	.prefix	= XATTR_SECURITY_PREFIX,
+	.get	= myfs_xattr_get,
+	.set	= myfs_xattr_set,
+};
+
+static const struct xattr_handler *myfs_xattr_handlers[] = {
+	&myfs_user_xattr_handler,
+	&myfs_trusted_xattr_handler,
+	&myfs_security_xattr_handler,
+	NULL
+};
+
+static int myfs_initxattrs(struct inode *inode,
+			   const struct xattr *xattr_array, void *fs_info)
+{
+	const struct xattr *xattr;
+	char *name;
+	int error = 0;
+
+	for (xattr = xattr_array; xattr->name && !error; xattr++) {
+		name = kasprintf(GFP_KERNEL, XATTR_SECURITY_PREFIX "%s",
+				 xattr->name);
+		if (!name)
+			return -ENOMEM;
+		error = myfs_xattr_store(inode, name, xattr->value,
+					 xattr->value_len, 0);
+		kfree(name);
+	}
+	return error;
+}
+
+/* Label a new inode; LSMs without xattrs give -EOPNOTSUPP. */
+static int myfs_init_security(struct inode *inode, struct inode *dir,
+			      const struct qstr *qstr)
+{
+	int error;
+
+	error = security_inode_init_security(inode, dir, qstr,
+					     myfs_initxattrs, NULL);
+	return error == -EOPNOTSUPP ? 0 : error;
+}
+
+static const struct inode_operations myfs_symlink_inode_operations = {
+	.get_link	= page_get_link,
+	.listxattr	= myfs_listxattr,
+};
+
+/* simple_getattr(), but reporting owners through the mount's idmapping */
+static int myfs_getattr(struct user_namespace *mnt_userns,
+			const struct path *path, struct kstat *stat,
+			u32 request_mask, unsigned int query_flags)
+{
+	struct inode *inode = d_inode(path->dentry);
+
+	generic_fillattr(mnt_userns, inode, stat);
+	stat->blocks = inode->i_mapping->nrpages << (PAGE_SHIFT - 9);
+	return 0;
+}
+
+static const struct inode_operations myfs_special_inode_operations = {
+	.setattr	= myfs_setattr,
+	.getattr	= myfs_getattr,
+	.listxattr	= myfs_listxattr,
+};
+
+static int myfs_fileattr_get(struct dentry *dentry, struct fileattr *fa);
+static int myfs_fileattr_set(struct user_namespace *mnt_userns,
+			     struct dentry *dentry, struct fileattr *fa);
+
+const struct inode_operations myfs_file_inode_operations = {
+	.setattr	= myfs_setattr,
+	.getattr	= myfs_getattr,
+	.listxattr	= myfs_listxattr,
+	.fileattr_get	= myfs_fileattr_get,
+	.fileattr_set	= myfs_fileattr_set,
+};
+
+#define RAMFS_DEFAULT_MODE	0755
+
+static const struct super_operations myfs_ops;
+static const struct inode_operations myfs_dir_inode_operations;
+static const struct file_operations myfs_dir_operations;
+static void myfs_inode_info_init(struct myfs_inode_info *mi);
+
+/*
+ * Directory-clustered inodes.  new_inode() hands out slab objects in
+ * creation order, so when several directories fill up at once their
+ * inodes interleave, and a readdir+stat scan of one directory misses
+ * the cache on nearly every entry.  Instead, inodes created in a
+ * directory are carved out of a MYFS_CLUSTER_SIZE chunk that directory
+ * allocates from.  A new directory starts out on its parent's chunk, so
+ * small directories stay next to their siblings, and gets one of its
+ * own once that fills up.  A chunk is freed when its last inode and the
+ * last directory allocating from it are gone, so a single live inode
+ * keeps all MYFS_CLUSTER_SIZE bytes around; the chunk is four pages to
+ * bound that.  Chunks come from an accounted cache through
+ * alloc_inode_sb(), as slab inodes do, and are charged to the creator
+ * of the inode that needed them.  Dentries come from the VFS's cache
+ * and cannot be placed this way.  Off unless mounted with cluster, until
+ * tools/myfs-scan-bench shows it paying for the memory it pins.
+ */
+#define MYFS_CLUSTER_SIZE	(4 * PAGE_SIZE)
+
+struct myfs_cluster {
+	spinlock_t		lock;
+	atomic_t		refs;		/* inodes in it + directories using it */
+	unsigned long		map;		/* slots in use, under lock */
+	struct myfs_inode_info	slots[];
+};
+
+static struct kmem_cache *myfs_cluster_cachep;
+static unsigned int myfs_cluster_slots __ro_after_init;
+
+static struct myfs_inode_info *myfs_cluster_take(struct myfs_cluster *c)
+{
+	struct myfs_inode_info *mi = NULL;
+	unsigned int slot;
+
+	spin_lock(&c->lock);
+	slot = find_first_zero_bit(&c->map, myfs_cluster_slots);
+	if (slot < myfs_cluster_slots) {
+		__set_bit(slot, &c->map);
+		atomic_inc(&c->refs);
+		mi = &c->slots[slot];
+	}
+	spin_unlock(&c->lock);
+	return mi;
+}
+
+static void myfs_cluster_put(struct myfs_cluster *c)
+{
+	if (c && atomic_dec_and_test(&c->refs))
+		kmem_cache_free(myfs_cluster_cachep, c);
+}
+
+/* Give back @mi's slot; the chunk may go with it. */
+static void myfs_cluster_free(struct myfs_inode_info *mi)
+{
+	struct myfs_cluster *c = mi->cluster_home;
+
+	spin_lock(&c->lock);
+	__clear_bit(mi - c->slots, &c->map);
+	spin_unlock(&c->lock);
+	myfs_cluster_put(c);
+}
+
+static struct myfs_inode_info *myfs_cluster_alloc(struct inode *dir,
+						  struct myfs_cluster **home)
+{
+	struct myfs_inode_info *dmi = MYFS_I(dir), *mi = NULL;
+	struct myfs_cluster *c, *old;
+
+	spin_lock(&dir->i_lock);
+	c = dmi->cluster;
+	if (c)
+		mi = myfs_cluster_take(c);
+	spin_unlock(&dir->i_lock);
+	if (mi) {
+		*home = c;
+		return mi;
+	}
+
+	c = alloc_inode_sb(dir->i_sb, myfs_cluster_cachep, GFP_KERNEL);
+	if (!c)
+		return NULL;
+	spin_lock_init(&c->lock);
+	atomic_set(&c->refs, 1);	/* @dir's */
+	c->map = 0;
+	mi = myfs_cluster_take(c);
+
+	/* a racing creator's chunk is just left to its inodes */
+	spin_lock(&dir->i_lock);
+	old = dmi->cluster;
+	dmi->cluster = c;
+	spin_unlock(&dir->i_lock);
+	myfs_cluster_put(old);
+	*home = c;
+	return mi;
+}
+
+/*
+ * new_inode(), with the inode placed next to @dir's other children: the
+ * slot stands in for ->alloc_inode(), the rest is what alloc_inode() and
+ * new_inode_pseudo() do with it before new_inode() lists it on @sb.
+ */
+static struct inode *myfs_new_inode(struct super_block *sb,
+				    const struct inode *dir)
+{
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_inode_info *mi;
+	struct myfs_cluster *c;
+	struct inode *inode;
+
+	if (!dir || !fsi->mount_opts.cluster)
+		return new_inode(sb);
+	mi = myfs_cluster_alloc((struct inode *)dir, &c);
+	if (!mi)
+		return new_inode(sb);
+
+	inode = &mi->vfs_inode;
+	inode_init_once(inode);
+	myfs_inode_info_init(mi);
+	mi->cluster_home = c;
+	if (inode_init_always(sb, inode)) {
+		myfs_cluster_free(mi);
+		return NULL;
+	}
+	spin_lock(&inode->i_lock);
+	inode->i_state = 0;
+	spin_unlock(&inode->i_lock);
+	inode_sb_list_add(inode);
+	return inode;
+}
+
+
+struct inode *myfs_get_inode(struct user_namespace *mnt_userns,
+			     struct super_block *sb, const struct inode *dir,
+			     umode_t mode, dev_t dev)
+{
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct inode * inode = myfs_new_inode(sb, dir);
+
+	if (inode) {
+		inode->i_ino = get_next_ino();
+		inode_init_owner(mnt_userns, inode, dir, mode);
+		inode->i_mapping->a_ops = &myfs_aops;
+		mapping_set_gfp_mask(inode->i_mapping, GFP_HIGHUSER);
+		mapping_set_unevictable(inode->i_mapping);
+		inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+		switch (mode & S_IFMT) {
+		default:
+			init_special_inode(inode, mode, dev);
+			inode->i_op = &myfs_special_inode_operations;
+			break;
+		case S_IFREG:
+			inode->i_op = &myfs_file_inode_operations;
+			inode->i_fop = &myfs_file_operations;
+			if (fsi->mount_opts.lru)
+				myfs_lru_add(inode);
+			break;
+		case S_IFDIR:
+			inode->i_op = &myfs_dir_inode_operations;
+			inode->i_fop = &myfs_dir_operations;
+			if (dir && IS_CASEFOLDED(dir))
+				inode->i_flags |= S_CASEFOLD;
+			if (MYFS_I(inode)->cluster_home) {
+				atomic_inc(&MYFS_I(inode)->cluster_home->refs);
+				MYFS_I(inode)->cluster = MYFS_I(inode)->cluster_home;
+			}
+
+			/* directory inodes start off with i_nlink == 2 (for "." entry) */
+			inc_nlink(inode);
+			break;
+		case S_IFLNK:
+			inode->i_op = &myfs_symlink_inode_operations;
+			inode_nohighmem(inode);
+			break;
+		}
+		if (dir) {
+			u64 ttl = READ_ONCE(MYFS_I((struct inode *)dir)->ttl);
+
+			inode->i_write_hint = dir->i_write_hint;
+
+			if (ttl && S_ISDIR(mode))
+				MYFS_I(inode)->ttl = ttl;
+			else if (ttl && S_ISREG(mode))
+				myfs_ttl_arm(inode, ttl, mnt_userns);
+		}
+	}
+	return inode;
+}
+
+/*
+ * Ordered name index for MYFS_IOC_LIST_RANGE.  Each directory keeps its
+ * names in an rbtree in memcmp() order alongside the dcache.  It only
+ * changes with the directory locked exclusively, so listings need the
+ * lock shared.  Entries are allocated before the operation that adds
+ * the name, so a name never misses the index.
+ */
+struct myfs_dirent {
+	struct rb_node	node;
+	unsigned long	ino;
+	unsigned char	type;		/* DT_* */
+	unsigned int	len;
+	char		name[];
+};
+
+static int myfs_name_cmp(const char *a, unsigned int alen,
+			 const char *b, unsigned int blen)
+{
+	int c = memcmp(a, b, min(alen, blen));
+
+	if (c)
+		return c;
+	return alen < blen ? -1 : alen > blen;
+}
+
+static struct myfs_dirent *myfs_dirent_alloc(const struct qstr *name)
+{
+	struct myfs_dirent *de;
+
+	de = kmalloc(struct_size(de, name, name->len + 1), GFP_KERNEL_ACCOUNT);
+	if (de) {
+		de->len = name->len;
+		memcpy(de->name, name->name, name->len);
+		de->name[name->len] = 0;
+	}
+	return de;
+}
+
+static void myfs_dirent_set(struct myfs_dirent *de, struct inode *inode)
+{
+	de->ino = inode->i_ino;
+	de->type = fs_umode_to_dtype(inode->i_mode);
+}
+
+static struct myfs_dirent *myfs_dirent_find(struct inode *dir,
+					    const struct qstr *name)
+{
+	struct rb_node *n = MYFS_I(dir)->dirents.rb_node;
+
+	while (n) {
+		struct myfs_dirent *de = rb_entry(n, struct myfs_dirent, node);
+		int c = myfs_name_cmp(name->name, name->len, de->name, de->len);
+
+		if (!c)
+			return de;
+		n = c < 0 ? n->rb_left : n->rb_right;
+	}
+	return NULL;
+}
+
+/* Add @de for @inode to @dir, replacing any entry of the same name. */
+static void myfs_dirent_add(struct inode *dir, struct myfs_dirent *de,
+			    struct inode *inode)
+{
+	struct rb_root *root = &MYFS_I(dir)->dirents;
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+
+	myfs_dirent_set(de, inode);
+	while (*p) {
+		struct myfs_dirent *cur = rb_entry(*p, struct myfs_dirent, node);
+		int c = myfs_name_cmp(de->name, de->len, cur->name, cur->len);
+
+		parent = *p;
+		if (c < 0) {
+			p = &parent->rb_left;
+		} else if (c > 0) {
+			p = &parent->rb_right;
+		} else {
+			rb_replace_node(&cur->node, &de->node, root);
+			kfree(cur);
+			return;
+		}
+	}
+	rb_link_node(&de->node, parent, p);
+	rb_insert_color(&de->node, root);
+}
+
+static void myfs_dirent_del(struct inode *dir, const struct qstr *name)
+{
+	struct myfs_dirent *de = myfs_dirent_find(dir, name);
+
+	if (de) {
+		rb_erase(&de->node, &MYFS_I(dir)->dirents);
+		kfree(de);
+	}
+}
+
+static void myfs_dirents_free(struct inode *dir)
+{
+	struct myfs_dirent *de, *n;
+
+	rbtree_postorder_for_each_entry_safe(de, n, &MYFS_I(dir)->dirents, node)
+		kfree(de);
+}
+
+/*
+ * File creation. Allocate an inode, and we're done..
+ */
+/* SMP-safe */
+static int
+__myfs_mknod(struct user_namespace *mnt_userns, struct inode *dir,
+	    struct dentry *dentry, umode_t mode, dev_t dev)
+{
+	struct myfs_dirent *de = myfs_dirent_alloc(&dentry->d_name);
+	struct inode * inode;
+	int error = -ENOSPC;
+
+	if (!de)
+		return -ENOMEM;
+	inode = myfs_get_inode(mnt_userns, dir->i_sb, dir, mode, dev);
+	if (inode) {
+		error = myfs_init_security(inode, dir, &dentry->d_name);
+		if (error) {
+			iput(inode);
+			kfree(de);
+			return error;
+		}
+		d_instantiate(dentry, inode);
+		dget(dentry);	/* Extra count - pin the dentry in core */
+		myfs_dirent_add(dir, de, inode);
+		error = 0;
+		dir->i_mtime = dir->i_ctime = current_time(dir);
+	} else
+		kfree(de);
+	return error;
+}
+
+static int
+myfs_mknod(struct user_namespace *mnt_userns, struct inode *dir,
+	    struct dentry *dentry, umode_t mode, dev_t dev)
+{
+	u64 start = myfs_op_start(myfs_namespace);
+	int error;
+
+	error = myfs_qos_charge_locked(dir->i_sb);
+	if (error)
+		return error;
+	error = __myfs_mknod(mnt_userns, dir, dentry, mode, dev);
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("mknod", dir, dentry, error ? NULL : d_inode(dentry),
+			     NULL, NULL, mode, error, start);
+	return error;
+}
+
+static int myfs_mkdir(struct user_namespace *mnt_userns, struct inode *dir,
+		       struct dentry *dentry, umode_t mode)
+{
+	u64 start = myfs_op_start(myfs_namespace);
+	int retval = myfs_qos_charge_locked(dir->i_sb);
+	if (retval)
+		return retval;
+	retval = __myfs_mknod(mnt_userns, dir, dentry, mode | S_IFDIR, 0);
+	if (!retval)
+		inc_nlink(dir);
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("mkdir", dir, dentry, retval ? NULL : d_inode(dentry),
+			     NULL, NULL, mode | S_IFDIR, retval, start);
+
+	printk(KERN_INFO "myfs: create dir %s success!\n", dentry->d_iname);
+	return retval;
+}
+
+static int myfs_create(struct user_namespace *mnt_userns, struct inode *dir,
+			struct dentry *dentry, umode_t mode, bool excl)
+{
+	u64 start = myfs_op_start(myfs_namespace);
+	int ret = 0;
+	ret = myfs_qos_charge_locked(dir->i_sb);
+	if (ret)
+		return ret;
+	ret =  __myfs_mknod(mnt_userns, dir, dentry, mode | S_IFREG, 0);
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("create", dir, dentry, ret ? NULL : d_inode(dentry),
+			     NULL, NULL, mode | S_IFREG, ret, start);
+	printk(KERN_INFO "myfs: create file %s success!\n", dentry->d_iname);
+	return ret;
+}
+
+static int myfs_symlink(struct user_namespace *mnt_userns, struct inode *dir,
+			 struct dentry *dentry, const char *symname)
+{
+	struct myfs_dirent *de;
+	struct inode *inode;
+	u64 start = myfs_op_start(myfs_namespace);
+	int error;
+
+	error = myfs_qos_charge_locked(dir->i_sb);
+	if (error)
+		return error;
+	de = myfs_dirent_alloc(&dentry->d_name);
+	if (!de)
+		return -ENOMEM;
+	error = -ENOSPC;
+	inode = myfs_get_inode(mnt_userns, dir->i_sb, dir, S_IFLNK|S_IRWXUGO, 0);
+	if (inode) {
+		int l = strlen(symname)+1;
+		error = myfs_init_security(inode, dir, &dentry->d_name);
+		if (!error)
+			error = page_symlink(inode, symname, l);
+		if (!error) {
+			d_instantiate(dentry, inode);
+			dget(dentry);
+			myfs_dirent_add(dir, de, inode);
+			de = NULL;
+			dir->i_mtime = dir->i_ctime = current_time(dir);
+		} else
+			iput(inode);
+	}
+	kfree(de);
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("symlink", dir, dentry, error ? NULL : d_inode(dentry),
+			     NULL, NULL, S_IFLNK|S_IRWXUGO, error, start);
+	return error;
+}
+
+static int myfs_tmpfile(struct user_namespace *mnt_userns,
+			 struct inode *dir, struct dentry *dentry, umode_t mode)
+{
+	struct inode *inode;
+	u64 start = myfs_op_start(myfs_namespace);
+	int error;
+
+	error = myfs_qos_charge_locked(dir->i_sb);
+	if (error)
+		return error;
+	inode = myfs_get_inode(mnt_userns, dir->i_sb, dir, mode, 0);
+	if (!inode)
+		return -ENOSPC;
+	error = myfs_init_security(inode, dir, NULL);
+	if (error) {
+		iput(inode);
+		return error;
+	}
+	d_tmpfile(dentry, inode);
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("tmpfile", dir, dentry, inode, NULL, NULL,
+			     mode, 0, start);
+	return 0;
+}
+
+static int myfs_link(struct dentry *old_dentry, struct inode *dir,
+		     struct dentry *dentry)
+{
+	struct myfs_dirent *de;
+	u64 start = myfs_op_start(myfs_namespace);
+	int error;
+
+	error = myfs_qos_charge_locked(dir->i_sb);
+	if (error)
+		return error;
+	de = myfs_dirent_alloc(&dentry->d_name);
+	if (!de)
+		return -ENOMEM;
+	error = simple_link(old_dentry, dir, dentry);
+	if (!error)
+		myfs_dirent_add(dir, de, d_inode(old_dentry));
+	else
+		kfree(de);
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("link", dir, dentry, d_inode(old_dentry),
+			     NULL, NULL, 0, error, start);
+	return error;
+}
+
+static int myfs_unlink(struct inode *dir, struct dentry *dentry)
+{
+	u64 start = myfs_op_start(myfs_namespace);
+	int error;
+
+	error = myfs_qos_charge_locked(dir->i_sb);
+	if (error)
+		return error;
+	error = simple_unlink(dir, dentry);
+	if (!error) {
+		myfs_dirent_del(dir, &dentry->d_name);
+		dentry->d_time = 0;
+	}
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("unlink", dir, dentry, d_inode(dentry),
+			     NULL, NULL, 0, error, start);
+	return error;
+}
+
+static int myfs_rmdir(struct inode *dir, struct dentry *dentry)
+{
+	u64 start = myfs_op_start(myfs_namespace);
+	int error;
+
+	error = myfs_qos_charge_locked(dir->i_sb);
+	if (error)
+		return error;
+	error = simple_rmdir(dir, dentry);
+	if (!error) {
+		myfs_dirent_del(dir, &dentry->d_name);
+		dentry->d_time = 0;
+	}
+	myfs_dir_account(dir, start);
+	trace_myfs_namespace("rmdir", dir, dentry, d_inode(dentry),
+			     NULL, NULL, 0, error, start);
+	return error;
+}
+
+static int myfs_rename(struct user_namespace *mnt_userns,
+			struct inode *old_dir, struct dentry *old_dentry,
+			struct inode *new_dir, struct dentry *new_dentry,
+			unsigned int flags)
+{
+	struct myfs_dirent *de = NULL;
+	u64 start = myfs_op_start(myfs_namespace);
+	int error;
+
+	error = myfs_qos_charge_locked(old_dir->i_sb);
+	if (error)
+		return error;
+	if (!(flags & RENAME_EXCHANGE)) {
+		de = myfs_dirent_alloc(&new_dentry->d_name);
+		if (!de)
+			return -ENOMEM;
+	}
+	error = simple_rename(mnt_userns, old_dir, old_dentry,
+			      new_dir, new_dentry, flags);
+	if (error) {
+		kfree(de);
+	} else if (flags & RENAME_EXCHANGE) {
+		struct myfs_dirent *a = myfs_dirent_find(old_dir, &old_dentry->d_name);
+		struct myfs_dirent *b = myfs_dirent_find(new_dir, &new_dentry->d_name);
+
+		if (a)
+			myfs_dirent_set(a, d_inode(new_dentry));
+		if (b)
+			myfs_dirent_set(b, d_inode(old_dentry));
+	} else {
+		myfs_dirent_del(old_dir, &old_dentry->d_name);
+		myfs_dirent_add(new_dir, de, d_inode(old_dentry));
+	}
+	myfs_dir_account(old_dir, start);
+	if (new_dir != old_dir)
+		myfs_dir_account(new_dir, start);
+	trace_myfs_namespace("rename", old_dir, old_dentry, d_inode(old_dentry),
+			     new_dir, new_dentry, flags, error, start);
+	return error;
+}
+
+static struct dentry *myfs_lookup(struct inode *dir, struct dentry *dentry,
+				  unsigned int flags)
+{
+	/* a miss, worth keeping negative: see myfs_d_delete() */
+	dentry->d_time = 1;
+	return simple_lookup(dir, dentry, flags);
+}
+
+static const struct inode_operations myfs_dir_inode_operations = {
+	.create		= myfs_create,
+	.lookup		= myfs_lookup,
+	.link		= myfs_link,
+	.unlink		= myfs_unlink,
+	.symlink	= myfs_symlink,
+	.mkdir		= myfs_mkdir,
+	.rmdir		= myfs_rmdir,
+	.mknod		= myfs_mknod,
+	.rename		= myfs_rename,
+	.tmpfile	= myfs_tmpfile,
+	.listxattr	= myfs_listxattr,
+	.fileattr_get	= myfs_fileattr_get,
+	.fileattr_set	= myfs_fileattr_set,
+};
+
+/*
+ * Multi-file commit (MYFS_IOC_COMMIT).  All destination directories are
+ * locked, ancestors first as the VFS does, under s_vfs_rename_mutex so
+ * no directory can move while we sort them.  Every entry is resolved
+ * and checked before anything is changed; the commit itself cannot
+ * fail.  While it runs each destination dentry is marked in d_fsdata,
+ * and myfs_d_revalidate() holds lookups that hit a marked dentry until
+ * all names are in place; lookups that miss the dcache block on the
+ * directory lock.
+ */
+#define MYFS_DENTRY_COMMITTING	((void *)1)
+
+static int myfs_d_revalidate(struct dentry *dentry, unsigned int flags)
+{
+	struct myfs_fs_info *fsi;
+
+	if (likely(!READ_ONCE(dentry->d_fsdata)))
+		return 1;
+	if (flags & LOOKUP_RCU)
+		return -ECHILD;
+	fsi = dentry->d_sb->s_fs_info;
+	/* the lookup fails if the caller is killed while it waits */
+	return wait_event_killable(fsi->commit_wq,
+				   !READ_ONCE(dentry->d_fsdata)) ?: 1;
+}
+
+/*
+ * Negative dentries from a lookup miss are kept, unlike ramfs: a lookup
+ * of a missing name can then finish in RCU walk, which is what lets
+ * io_uring complete LOOKUP_CACHED opens and stats inline instead of
+ * punting them to a worker.  myfs_lookup() marks those in d_time.  The
+ * names unlink and rmdir leave behind are cleared and dropped, or temp
+ * file churn would pile them up on d_subdirs, which readdir and rmdir
+ * walk.  Every positive dentry is pinned, so the shrinker only ever sees
+ * negative ones.  Casefolded directories drop them all; a cached
+ * negative "foo" would otherwise give a new "Foo" its spelling.
+ */
+static int myfs_d_delete(const struct dentry *dentry)
+{
+	return !dentry->d_time || IS_CASEFOLDED(d_inode(dentry->d_parent));
+}
+
+static const struct dentry_operations myfs_dentry_operations = {
+	.d_revalidate	= myfs_d_revalidate,
+	.d_delete	= myfs_d_delete,
+};
+
+#if IS_ENABLED(CONFIG_UNICODE)
+/*
+ * Casefolded directories.  Names are hashed on their casefolded form, so
+ * the dcache hash table is the case-insensitive index and a lookup in
+ * any case is a single hash probe.  These ops are only installed on
+ * mounts with "casefold", other mounts keep the plain byte-wise hash.
+ * Names that are not valid UTF-8 fall back to exact matching.
+ */
+static int myfs_ci_d_hash(const struct dentry *dentry, struct qstr *str)
+{
+	const struct inode *dir = READ_ONCE(dentry->d_inode);
+
+	if (!dir || !IS_CASEFOLDED(dir))
+		return 0;
+	/* on invalid UTF-8 keep the hash the VFS already computed */
+	utf8_casefold_hash(dentry->d_sb->s_encoding, dentry, str);
+	return 0;
+}
+
+static int myfs_ci_d_compare(const struct dentry *dentry, unsigned int len,
+			     const char *str, const struct qstr *name)
+{
+	const struct dentry *parent = READ_ONCE(dentry->d_parent);
+	const struct inode *dir = READ_ONCE(parent->d_inode);
+	struct qstr qstr = QSTR_INIT(str, len);
+	char strbuf[DNAME_INLINE_LEN];
+	int ret;
+
+	if (!dir || !IS_CASEFOLDED(dir))
+		goto exact;
+	/*
+	 * An inline name can change under us in RCU walk if the dentry is
+	 * renamed; the VFS retries then, but utf8_strncasecmp() must not
+	 * see the string change, so compare a copy.
+	 */
+	if (len <= DNAME_INLINE_LEN - 1) {
+		memcpy(strbuf, str, len);
+		strbuf[len] = 0;
+		qstr.name = strbuf;
+		barrier();
+	}
+	ret = utf8_strncasecmp(dentry->d_sb->s_encoding, name, &qstr);
+	if (ret >= 0)
+		return ret;
+exact:
+	if (len != name->len)
+		return 1;
+	return !!memcmp(str, name->name, len);
+}
+
+static const struct dentry_operations myfs_ci_dentry_operations = {
+	.d_revalidate	= myfs_d_revalidate,
+	.d_delete	= myfs_d_delete,
+	.d_hash		= myfs_ci_d_hash,
+	.d_compare	= myfs_ci_d_compare,
+};
+#endif
+
+/*
+ * FS_IOC_GETFLAGS/SETFLAGS.  The only flag is FS_CASEFOLD_FL, settable
+ * on empty directories of a casefold mount; new directories inherit it.
+ */
+static int myfs_fileattr_get(struct dentry *dentry, struct fileattr *fa)
+{
+	fileattr_fill_flags(fa, IS_CASEFOLDED(d_inode(dentry)) ?
+				FS_CASEFOLD_FL : 0);
+	return 0;
+}
+
+static int myfs_fileattr_set(struct user_namespace *mnt_userns,
+			     struct dentry *dentry, struct fileattr *fa)
+{
+	struct inode *inode = d_inode(dentry);
+	bool casefold = fa->flags & FS_CASEFOLD_FL;
+
+	if (fileattr_has_fsx(fa) || (fa->flags & ~FS_CASEFOLD_FL))
+		return -EOPNOTSUPP;
+	if (casefold == IS_CASEFOLDED(inode))
+		return 0;
+	if (!S_ISDIR(inode->i_mode))
+		return -ENOTDIR;
+	if (!sb_has_encoding(inode->i_sb))
+		return -EOPNOTSUPP;
+	if (!simple_empty(dentry))
+		return -ENOTEMPTY;
+	/* negative children were hashed the other way */
+	shrink_dcache_parent(dentry);
+	inode_set_flags(inode, casefold ? S_CASEFOLD : 0, S_CASEFOLD);
+	inode->i_ctime = current_time(inode);
+	return 0;
+}
+
+struct myfs_commit_item {
+	struct inode	*inode;		/* source, referenced */
+	struct dentry	*dir;		/* destination directory, referenced */
+	struct dentry	*dentry;	/* destination name, from lookup */
+	struct dentry	*new;		/* in case the replaced name is busy */
+	struct myfs_dirent *de;		/* preallocated index entry */
+	unsigned int	depth;
+	unsigned int	flags;
+	char		name[NAME_MAX + 1];
+};
+
+/* Same test as may_linkat() applies with protected_hardlinks. */
+static int myfs_commit_may_link(struct user_namespace *mnt_userns,
+				struct inode *inode)
+{
+	umode_t mode = inode->i_mode;
+
+	if (IS_APPEND(inode) || IS_IMMUTABLE(inode))
+		return -EPERM;
+	if (inode_owner_or_capable(mnt_userns, inode))
+		return 0;
+	if (!S_ISREG(mode) || (mode & S_ISUID) ||
+	    (mode & (S_ISGID | S_IXGRP)) == (S_ISGID | S_IXGRP) ||
+	    inode_permission(mnt_userns, inode, MAY_READ | MAY_WRITE))
+		return -EPERM;
+	return 0;
+}
+
+/* As vfs_link(): an unlinked inode may only come back from O_TMPFILE. */
+static int myfs_commit_linkable(struct inode *inode)
+{
+	if (!inode->i_nlink && !(inode->i_state & I_LINKABLE))
+		return -ENOENT;
+	return 0;
+}
+
+static int myfs_commit_prepare(struct file *filp, struct myfs_commit_entry *e,
+			       struct myfs_commit_item *it)
+{
+	struct user_namespace *mnt_userns = file_mnt_user_ns(filp);
+	struct inode *inode;
+	struct qstr qname;
+	struct fd f;
+	size_t len;
+	int error;
+
+	len = strnlen(e->name, sizeof(e->name));
+	if (!len || len == sizeof(e->name) || strchr(e->name, '/') ||
+	    !strcmp(e->name, ".") || !strcmp(e->name, ".."))
+		return -EINVAL;
+	if ((e->flags & ~MYFS_COMMIT_REPLACE) || e->__reserved)
+		return -EINVAL;
+	memcpy(it->name, e->name, len + 1);
+	it->flags = e->flags;
+	qname = (struct qstr)QSTR_INIT(it->name, len);
+	it->de = myfs_dirent_alloc(&qname);
+	if (!it->de)
+		return -ENOMEM;
+
+	if (e->src_fd >= 0) {
+		f = fdget(e->src_fd);
+		if (!f.file)
+			return -EBADF;
+		inode = file_inode(f.file);
+		ihold(inode);
+		fdput(f);
+	} else {
+		struct path path;
+
+		error = user_path_at(AT_FDCWD, u64_to_user_ptr(e->src_path),
+				     0, &path);
+		if (error)
+			return error;
+		inode = d_inode(path.dentry);
+		ihold(inode);
+		path_put(&path);
+	}
+	it->inode = inode;
+	/* as linkat(AT_EMPTY_PATH) */
+	if (e->src_fd >= 0 && !(inode->i_state & I_LINKABLE) &&
+	    !capable(CAP_DAC_READ_SEARCH))
+		return -EPERM;
+	if (inode->i_sb != file_inode(filp)->i_sb)
+		return -EXDEV;
+	if (S_ISDIR(inode->i_mode))
+		return -EISDIR;
+	error = myfs_commit_linkable(inode);
+	if (error)
+		return error;
+	error = myfs_commit_may_link(mnt_userns, inode);
+	if (error)
+		return error;
+
+	f = fdget(e->dst_dirfd);
+	if (!f.file)
+		return -EBADF;
+	it->dir = dget(f.file->f_path.dentry);
+	if (f.file->f_path.mnt != filp->f_path.mnt)
+		error = -EXDEV;
+	else if (!d_is_dir(it->dir))
+		error = -ENOTDIR;
+	else
+		error = inode_permission(mnt_userns, d_inode(it->dir),
+					 MAY_WRITE | MAY_EXEC);
+	fdput(f);
+	return error;
+}
+
+static unsigned int myfs_dentry_depth(struct dentry *dentry)
+{
+	unsigned int depth = 0;
+
+	while (!IS_ROOT(dentry)) {
+		dentry = dentry->d_parent;
+		depth++;
+	}
+	return depth;
+}
+
+static int myfs_commit_cmp(const void *a, const void *b)
+{
+	const struct myfs_commit_item *x = a, *y = b;
+
+	if (x->depth != y->depth)
+		return x->depth < y->depth ? -1 : 1;
+	if (x->dir != y->dir)
+		return x->dir < y->dir ? -1 : 1;
+	return 0;
+}
+
+static void myfs_commit_lock_dir(struct inode *dir, struct mutex *nest)
+{
+	u64 start;
+
+	if (down_write_trylock(&dir->i_rwsem)) {
+		myfs_lock_account(dir, MYFS_LOCK_DIR, 0, false);
+		return;
+	}
+	start = myfs_lock_timed() ? ktime_get_ns() : 0;
+	down_write_nest_lock(&dir->i_rwsem, nest);
+	myfs_lock_account(dir, MYFS_LOCK_DIR,
+			  start ? ktime_get_ns() - start : 0, true);
+}
+
+static int myfs_commit_inode_cmp(const void *a, const void *b)
+{
+	struct inode * const *x = a, * const *y = b;
+
+	if (*x == *y)
+		return 0;
+	return *x < *y ? -1 : 1;
+}
+
+/*
+ * Lock every distinct source and replaced inode after the directories, in
+ * address order as lock_two_nondirectories() does, so an unlink cannot
+ * take a source to nlink 0 between myfs_commit_check() and the link, and
+ * a replaced inode loses its link under its own lock as in vfs_rename().
+ */
+static void myfs_commit_lock_inodes(struct inode **inodes, unsigned int nr,
+				    struct mutex *nest)
+{
+	unsigned int i;
+
+	sort(inodes, nr, sizeof(*inodes), myfs_commit_inode_cmp, NULL);
+	for (i = 0; i < nr; i++)
+		if (!i || inodes[i] != inodes[i - 1])
+			down_write_nest_lock(&inodes[i]->i_rwsem, nest);
+}
+
+static void myfs_commit_unlock_inodes(struct inode **inodes, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = nr; i-- > 0; )
+		if (!i || inodes[i] != inodes[i - 1])
+			inode_unlock(inodes[i]);
+}
+
+/* Look up every destination; called with all directories locked. */
+static int myfs_commit_lookup(struct user_namespace *mnt_userns,
+			      struct myfs_commit_item *items, unsigned int nr)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < nr; i++) {
+		struct myfs_commit_item *it = &items[i];
+		struct dentry *d;
+
+		if (IS_DEADDIR(d_inode(it->dir)))
+			return -ENOENT;
+		d = lookup_one(mnt_userns, it->name, it->dir, strlen(it->name));
+		if (IS_ERR(d))
+			return PTR_ERR(d);
+		it->dentry = d;
+		for (j = 0; j < i; j++)
+			if (items[j].dentry == d)
+				return -EINVAL;
+		if (d_really_is_negative(d))
+			continue;
+		if (!(it->flags & MYFS_COMMIT_REPLACE))
+			return -EEXIST;
+		if (d_is_dir(d))
+			return -EISDIR;
+		if (d_mountpoint(d))
+			return -EBUSY;
+		it->new = d_alloc(it->dir, &d->d_name);
+		if (!it->new)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/* Again, now that the sources are locked. */
+static int myfs_commit_check(struct myfs_commit_item *items, unsigned int nr)
+{
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < nr; i++) {
+		error = myfs_commit_linkable(items[i].inode);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+static void myfs_commit_one(struct myfs_commit_item *it, u64 start)
+{
+	struct inode *dir = d_inode(it->dir);
+	struct inode *inode = it->inode;
+	struct dentry *target = it->dentry;
+	struct timespec64 now = current_time(dir);
+
+	if (d_really_is_positive(target)) {
+		struct inode *victim = d_inode(target);
+
+		/* as simple_unlink(), but keep our lookup reference */
+		victim->i_ctime = now;
+		drop_nlink(victim);
+		fsnotify_link_count(victim);
+		dput(target);
+		d_delete_notify(dir, target);
+		/* still in use elsewhere: d_delete() unhashed it */
+		if (d_unhashed(target))
+			target = it->new;
+	}
+
+	/* as simple_link(), which also takes an O_TMPFILE to nlink 1 */
+	inode->i_ctime = now;
+	inc_nlink(inode);
+	if (inode->i_state & I_LINKABLE) {
+		spin_lock(&inode->i_lock);
+		inode->i_state &= ~I_LINKABLE;
+		spin_unlock(&inode->i_lock);
+	}
+	ihold(inode);
+	dget(target);
+	if (d_unhashed(target))
+		d_add(target, inode);
+	else
+		d_instantiate(target, inode);
+	dir->i_mtime = dir->i_ctime = now;
+	myfs_dirent_add(dir, it->de, inode);
+	it->de = NULL;
+	fsnotify_link(dir, inode, target);
+	trace_myfs_namespace("commit", dir, target, inode, NULL, NULL,
+			     it->flags, 0, start);
+}
+
+static long myfs_ioc_commit(struct file *filp, struct myfs_commit __user *arg)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_commit_entry *entries;
+	struct myfs_commit_item *items;
+	struct inode **inodes;
+	struct myfs_commit c;
+	u64 start = myfs_op_start(myfs_namespace);
+	unsigned int i, nr_inodes = 0;
+	int error;
+
+	if (copy_from_user(&c, arg, sizeof(c)))
+		return -EFAULT;
+	if (!c.nr || c.nr > MYFS_COMMIT_MAX || c.flags)
+		return -EINVAL;
+	entries = vmemdup_user(u64_to_user_ptr(c.entries),
+			       array_size(c.nr, sizeof(*entries)));
+	if (IS_ERR(entries))
+		return PTR_ERR(entries);
+	items = kvcalloc(c.nr, sizeof(*items), GFP_KERNEL);
+	/* each source, and each inode a name is replaced from */
+	inodes = kvmalloc_array(2 * c.nr, sizeof(*inodes), GFP_KERNEL);
+	if (!items || !inodes) {
+		error = -ENOMEM;
+		goto out_free;
+	}
+
+	error = mnt_want_write_file(filp);
+	if (error)
+		goto out_free;
+	for (i = 0; i < c.nr; i++) {
+		error = myfs_commit_prepare(filp, &entries[i], &items[i]);
+		if (error)
+			goto out_put;
+	}
+	error = myfs_qos_charge(sb, MYFS_QOS_OPS, c.nr, false);
+	if (error)
+		goto out_put;
+
+	mutex_lock(&sb->s_vfs_rename_mutex);
+	for (i = 0; i < c.nr; i++)
+		items[i].depth = myfs_dentry_depth(items[i].dir);
+	sort(items, c.nr, sizeof(*items), myfs_commit_cmp, NULL);
+	for (i = 0; i < c.nr; i++)
+		if (!i || items[i].dir != items[i - 1].dir)
+			myfs_commit_lock_dir(d_inode(items[i].dir),
+					     &sb->s_vfs_rename_mutex);
+
+	error = myfs_commit_lookup(file_mnt_user_ns(filp), items, c.nr);
+	if (error)
+		goto out_unlock;
+	for (i = 0; i < c.nr; i++) {
+		inodes[nr_inodes++] = items[i].inode;
+		if (d_really_is_positive(items[i].dentry))
+			inodes[nr_inodes++] = d_inode(items[i].dentry);
+	}
+	myfs_commit_lock_inodes(inodes, nr_inodes, &sb->s_vfs_rename_mutex);
+
+	error = myfs_commit_check(items, c.nr);
+	if (!error) {
+		for (i = 0; i < c.nr; i++) {
+			WRITE_ONCE(items[i].dentry->d_fsdata, MYFS_DENTRY_COMMITTING);
+			if (items[i].new)
+				WRITE_ONCE(items[i].new->d_fsdata, MYFS_DENTRY_COMMITTING);
+		}
+		smp_wmb();
+		for (i = 0; i < c.nr; i++)
+			myfs_commit_one(&items[i], start);
+		for (i = 0; i < c.nr; i++) {
+			WRITE_ONCE(items[i].dentry->d_fsdata, NULL);
+			if (items[i].new)
+				WRITE_ONCE(items[i].new->d_fsdata, NULL);
+		}
+		wake_up_all(&fsi->commit_wq);
+	}
+
+	myfs_commit_unlock_inodes(inodes, nr_inodes);
+out_unlock:
+	for (i = c.nr; i-- > 0; ) {
+		if (!i || items[i].dir != items[i - 1].dir) {
+			struct inode *dir = d_inode(items[i].dir);
+
+			if (!error)
+				myfs_dir_account(dir, start);
+			inode_unlock(dir);
+		}
+	}
+	mutex_unlock(&sb->s_vfs_rename_mutex);
+
+out_put:
+	for (i = 0; i < c.nr; i++) {
+		kfree(items[i].de);
+		dput(items[i].new);
+		dput(items[i].dentry);
+		dput(items[i].dir);
+		iput(items[i].inode);
+	}
+	mnt_drop_write_file(filp);
+out_free:
+	kvfree(inodes);
+	kvfree(items);
+	kvfree(entries);
+	return error;
+}
+
+/*
+ * MYFS_IOC_LIST_RANGE.  Seeks to the marker (or prefix) in the name
+ * index and walks forward, so a page costs O(page size * log n) however
+ * large the directory is; a collapsed prefix is stepped over with one
+ * more seek.  Records are built under the shared directory lock into a
+ * bounce buffer of at most MYFS_LIST_MAX_BUF bytes and copied out after.
+ */
+#define MYFS_LIST_MAX_BUF	(1 << 20)
+
+struct myfs_list_keys {
+	char	prefix[NAME_MAX + 1];
+	char	key[NAME_MAX + 1];
+	char	next[NAME_MAX + 1];
+};
+
+/* First entry after @key, or at it if @inclusive. */
+static struct rb_node *myfs_dirent_seek(struct inode *dir, const char *key,
+					unsigned int len, bool inclusive)
+{
+	struct rb_node *n = MYFS_I(dir)->dirents.rb_node, *found = NULL;
+
+	while (n) {
+		struct myfs_dirent *de = rb_entry(n, struct myfs_dirent, node);
+		int c = myfs_name_cmp(de->name, de->len, key, len);
+
+		if (c > 0 || (!c && inclusive)) {
+			found = n;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+	return found;
+}
+
+static long myfs_ioc_list_range(struct file *filp,
+				struct myfs_list_range __user *arg)
+{
+	struct inode *dir = file_inode(filp);
+	struct myfs_list_range lr;
+	struct myfs_list_keys *k;
+	unsigned int plen, klen, nlen = 0, nr = 0, truncated = 0;
+	unsigned int delim, buf_len, off = 0;
+	struct rb_node *n;
+	char *buf;
+	long error;
+
+	if (copy_from_user(&lr, arg, sizeof(lr)))
+		return -EFAULT;
+	if (lr.flags || lr.prefix_len > NAME_MAX || lr.marker_len > NAME_MAX ||
+	    lr.delimiter > 0xfe)
+		return -EINVAL;
+	plen = lr.prefix_len;
+	klen = lr.marker_len;
+	delim = lr.delimiter;
+
+	k = kmalloc(sizeof(*k), GFP_KERNEL);
+	if (!k)
+		return -ENOMEM;
+	error = -EFAULT;
+	if (copy_from_user(k->prefix, u64_to_user_ptr(lr.prefix), plen) ||
+	    copy_from_user(k->key, u64_to_user_ptr(lr.marker), klen))
+		goto out_keys;
+	buf_len = min_t(u32, lr.buf_len, MYFS_LIST_MAX_BUF);
+	error = -ENOMEM;
+	buf = kvmalloc(buf_len, GFP_KERNEL);
+	if (!buf)
+		goto out_keys;
+	error = myfs_qos_charge(dir->i_sb, MYFS_QOS_OPS, 1, false);
+	if (error)
+		goto out_buf;
+
+	inode_lock_shared(dir);
+	if (myfs_name_cmp(k->key, klen, k->prefix, plen) < 0) {
+		n = myfs_dirent_seek(dir, k->prefix, plen, true);
+	} else if (delim && klen > plen &&
+		   (unsigned char)k->key[klen - 1] == delim &&
+		   !memcmp(k->key, k->prefix, plen)) {
+		/* resuming after a common prefix: skip all of it */
+		k->key[klen - 1]++;
+		n = myfs_dirent_seek(dir, k->key, klen, true);
+	} else {
+		n = myfs_dirent_seek(dir, k->key, klen, false);
+	}
+
+	while (n) {
+		struct myfs_dirent *de = rb_entry(n, struct myfs_dirent, node);
+		struct myfs_list_entry *le;
+		unsigned int len = de->len, rec_len;
+		const char *cp = NULL;
+
+		if (len < plen || memcmp(de->name, k->prefix, plen))
+			break;
+		if (delim)
+			cp = memchr(de->name + plen, delim, len - plen);
+		if (cp)
+			len = cp - de->name + 1;
+		rec_len = ALIGN(sizeof(*le) + len + 1, 8);
+		if ((lr.max_entries && nr == lr.max_entries) ||
+		    off + rec_len > buf_len) {
+			truncated = 1;
+			break;
+		}
+
+		le = (struct myfs_list_entry *)(buf + off);
+		le->ino = cp ? 0 : de->ino;
+		le->rec_len = rec_len;
+		le->name_len = len;
+		le->type = cp ? MYFS_LIST_PREFIX : de->type;
+		le->__pad = 0;
+		memcpy(le->name, de->name, len);
+		memset(le->name + len, 0, rec_len - sizeof(*le) - len);
+		off += rec_len;
+		nr++;
+		memcpy(k->next, de->name, len);
+		nlen = len;
+
+		if (cp) {
+			memcpy(k->key, de->name, len);
+			k->key[len - 1]++;
+			n = myfs_dirent_seek(dir, k->key, len, true);
+		} else {
+			n = rb_next(n);
+		}
+	}
+	inode_unlock_shared(dir);
+
+	error = -EOVERFLOW;
+	if (truncated && !nr)
+		goto out_buf;
+	error = -EFAULT;
+	if (copy_to_user(u64_to_user_ptr(lr.buf), buf, off))
+		goto out_buf;
+	if (truncated) {
+		k->next[nlen] = 0;
+		if (copy_to_user(u64_to_user_ptr(lr.next_marker), k->next,
+				 nlen + 1))
+			goto out_buf;
+	}
+	lr.nr_entries = nr;
+	lr.truncated = truncated;
+	error = copy_to_user(arg, &lr, sizeof(lr)) ? -EFAULT : 0;
+out_buf:
+	kvfree(buf);
+out_keys:
+	kfree(k);
+	return error;
+}
+
+/*
+ * Live migration (MYFS_IOC_MIGRATE_SEND).  A FULL pass streams every
+ * linked inode, directory listing and page to a file and turns on
+ * change tracking.  Each DELTA pass sends only what changed since the
+ * previous pass started.  FINAL does the same with the filesystem
+ * frozen, so the receiver (tools/myfs-migrate recv) ends up with an
+ * exact copy, and leaves it frozen until the caller is done cutting
+ * over and thaws it with FITHAW; a FINAL pass that fails thaws it.  An inode or directory has changed if its ctime or
+ * mtime is not older than the previous pass, or if it was truncated.
+ * Pages are tagged PAGECACHE_TAG_TOWRITE when written; myfs never does
+ * writeback, so nothing else uses that tag.  A pass clears the tag and
+ * write-protects the page's mappings before copying it, so a later
+ * store tags it again through ->page_mkwrite.  Listings come from the
+ * ordered name index, in chunks, with the directory unlocked while a
+ * chunk is written out.
+ */
+#define MYFS_MIG_BUF		(16 * PAGE_SIZE)
+#define MYFS_MIG_BATCH		16	/* pages looked up at a time */
+#define MYFS_MIG_DIR_MIN	(sizeof(struct myfs_mig_hdr) + \
+				 sizeof(struct myfs_mig_dir) + \
+				 sizeof(struct myfs_mig_dirent) + NAME_MAX + 8)
+
+struct myfs_mig {
+	struct file		*out;
+	char			*buf;
+	size_t			used;
+	struct timespec64	since;	/* start of the previous pass */
+	bool			full;
+	struct myfs_migrate	stats;
+};
+
+static int myfs_mig_flush(struct myfs_mig *m)
+{
+	char *p = m->buf;
+	ssize_t n;
+
+	while (m->used) {
+		n = kernel_write(m->out, p, m->used, &m->out->f_pos);
+		if (n <= 0)
+			return n ?: -EIO;
+		p += n;
+		m->used -= n;
+		m->stats.bytes += n;
+	}
+	return 0;
+}
+
+/* Room for a record with @len bytes of payload; returns the payload. */
+static void *myfs_mig_rec(struct myfs_mig *m, u32 type, u64 ino, size_t len)
+{
+	size_t size = sizeof(struct myfs_mig_hdr) + ALIGN(len, 8);
+	struct myfs_mig_hdr *h;
+	int error;
+
+	if (m->used + size > MYFS_MIG_BUF) {
+		error = myfs_mig_flush(m);
+		if (error)
+			return ERR_PTR(error);
+	}
+	h = (struct myfs_mig_hdr *)(m->buf + m->used);
+	h->type = type;
+	h->len = len;
+	h->ino = ino;
+	memset(h + 1, 0, ALIGN(len, 8));
+	m->used += size;
+	return h + 1;
+}
+
+static bool myfs_mig_changed(struct myfs_mig *m, struct inode *inode)
+{
+	return m->full || MYFS_I(inode)->mig_trunc != U64_MAX ||
+	       timespec64_compare(&inode->i_ctime, &m->since) >= 0 ||
+	       timespec64_compare(&inode->i_mtime, &m->since) >= 0;
+}
+
+static int myfs_mig_inode(struct myfs_mig *m, struct inode *inode)
+{
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	struct myfs_mig_inode *r;
+	struct page *page = NULL;
+	size_t tlen = 0;
+	int error = 0;
+
+	inode_lock_shared(inode);
+	if (!myfs_mig_changed(m, inode))
+		goto out;
+	if (S_ISLNK(inode->i_mode)) {
+		page = find_get_page(inode->i_mapping, 0);
+		if (page)
+			tlen = min_t(loff_t, i_size_read(inode), PAGE_SIZE - 1);
+	}
+	r = myfs_mig_rec(m, MYFS_MIG_INODE, inode->i_ino, sizeof(*r) + tlen);
+	if (IS_ERR(r)) {
+		error = PTR_ERR(r);
+		goto out;
+	}
+	r->mode = inode->i_mode;
+	r->nlink = inode->i_nlink;
+	r->uid = i_uid_read(inode);
+	r->gid = i_gid_read(inode);
+	r->rdev = new_encode_dev(inode->i_rdev);
+	r->size = i_size_read(inode);
+	r->trunc = mi->mig_trunc;
+	mi->mig_trunc = U64_MAX;
+	r->atime_sec = inode->i_atime.tv_sec;
+	r->atime_nsec = inode->i_atime.tv_nsec;
+	r->mtime_sec = inode->i_mtime.tv_sec;
+	r->mtime_nsec = inode->i_mtime.tv_nsec;
+	r->ctime_sec = inode->i_ctime.tv_sec;
+	r->ctime_nsec = inode->i_ctime.tv_nsec;
+	if (tlen)
+		memcpy_from_page((char *)(r + 1), page, 0, tlen);
+	m->stats.inodes++;
+out:
+	inode_unlock_shared(inode);
+	if (page)
+		put_page(page);
+	return error;
+}
+
+static int myfs_mig_dir(struct myfs_mig *m, struct inode *dir)
+{
+	char *last = m->buf + MYFS_MIG_BUF;	/* NAME_MAX + 1 spare bytes */
+	unsigned int last_len = 0;
+	struct myfs_mig_hdr *h;
+	struct myfs_mig_dir *d;
+	struct myfs_dirent *de;
+	struct rb_node *n;
+	size_t size;
+	int error;
+
+	do {
+		if (MYFS_MIG_BUF - m->used < MYFS_MIG_DIR_MIN) {
+			error = myfs_mig_flush(m);
+			if (error)
+				return error;
+		}
+		inode_lock_shared(dir);
+		if (!last_len && !myfs_mig_changed(m, dir)) {
+			inode_unlock_shared(dir);
+			return 0;
+		}
+		h = (struct myfs_mig_hdr *)(m->buf + m->used);
+		h->type = MYFS_MIG_DIR;
+		h->ino = dir->i_ino;
+		d = (struct myfs_mig_dir *)(h + 1);
+		d->flags = last_len ? MYFS_MIG_DIR_CONT : 0;
+		d->nr = 0;
+		size = sizeof(*h) + sizeof(*d);
+
+		n = last_len ? myfs_dirent_seek(dir, last, last_len, false) :
+			       rb_first(&MYFS_I(dir)->dirents);
+		for (; n; n = rb_next(n)) {
+			struct myfs_mig_dirent *e;
+			size_t elen;
+
+			de = rb_entry(n, struct myfs_dirent, node);
+			elen = ALIGN(sizeof(*e) + de->len + 1, 8);
+			if (m->used + size + elen > MYFS_MIG_BUF)
+				break;
+			e = (struct myfs_mig_dirent *)(m->buf + m->used + size);
+			memset(e, 0, elen);
+			e->ino = de->ino;
+			e->name_len = de->len;
+			e->type = de->type;
+			memcpy(e->name, de->name, de->len);
+			memcpy(last, de->name, de->len);
+			last_len = de->len;
+			d->nr++;
+			size += elen;
+		}
+		inode_unlock_shared(dir);
+
+		h->len = size - sizeof(*h);
+		m->used += size;
+		m->stats.dirs++;
+	} while (n);
+	return 0;
+}
+
+static int myfs_mig_page(struct myfs_mig *m, struct address_space *mapping,
+			 struct page *page)
+{
+	size_t size = sizeof(struct myfs_mig_hdr) +
+		      ALIGN(sizeof(struct myfs_mig_data) + PAGE_SIZE, 8);
+	struct myfs_mig_data *d;
+
+	d = myfs_mig_rec(m, MYFS_MIG_DATA, mapping->host->i_ino,
+			 sizeof(*d) + PAGE_SIZE);
+	if (IS_ERR(d))
+		return PTR_ERR(d);
+	lock_page(page);
+	if (page->mapping != mapping) {
+		/* truncated meanwhile */
+		unlock_page(page);
+		m->used -= size;
+		return 0;
+	}
+	xa_lock_irq(&mapping->i_pages);
+	__xa_clear_mark(&mapping->i_pages, page->index, PAGECACHE_TAG_TOWRITE);
+	xa_unlock_irq(&mapping->i_pages);
+	if (page_mapped(page))
+		page_mkclean(page);
+	d->index = page->index;
+	memcpy_from_page((char *)(d + 1), page, 0, PAGE_SIZE);
+	unlock_page(page);
+	m->stats.pages++;
+	return 0;
+}
+
+static int myfs_mig_pages(struct myfs_mig *m, struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct page *pages[MYFS_MIG_BATCH];
+	pgoff_t index = 0;
+	unsigned int nr, i;
+	int error = 0;
+
+	while (!error) {
+		if (m->full)
+			nr = find_get_pages_range(mapping, &index, (pgoff_t)-1,
+						  MYFS_MIG_BATCH, pages);
+		else
+			nr = find_get_pages_range_tag(mapping, &index, (pgoff_t)-1,
+						      PAGECACHE_TAG_TOWRITE,
+						      MYFS_MIG_BATCH, pages);
+		if (!nr)
+			break;
+		for (i = 0; i < nr; i++) {
+			if (!error)
+				error = myfs_mig_page(m, mapping, pages[i]);
+			put_page(pages[i]);
+		}
+		if (!error && fatal_signal_pending(current))
+			error = -EINTR;
+		cond_resched();
+	}
+	return error;
+}
+
+static int myfs_mig_one(struct myfs_mig *m, struct inode *inode)
+{
+	int error;
+
+	/* unlinked: gone from every listing, nothing to send */
+	if (!inode->i_nlink)
+		return 0;
+	error = myfs_mig_inode(m, inode);
+	if (!error && S_ISDIR(inode->i_mode))
+		error = myfs_mig_dir(m, inode);
+	if (!error && S_ISREG(inode->i_mode))
+		error = myfs_mig_pages(m, inode);
+	return error;
+}
+
+static int myfs_mig_send(struct myfs_mig *m, struct super_block *sb, u32 pass)
+{
+	struct inode *inode, *toput_inode = NULL;
+	struct myfs_mig_start *s;
+	int error = 0;
+
+	s = myfs_mig_rec(m, MYFS_MIG_START, 0, sizeof(*s));
+	if (IS_ERR(s))
+		return PTR_ERR(s);
+	s->magic = MYFS_MIG_MAGIC;
+	s->pass = pass;
+	s->root_ino = d_inode(sb->s_root)->i_ino;
+	s->page_size = PAGE_SIZE;
+
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		spin_lock(&inode->i_lock);
+		if (inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&sb->s_inode_list_lock);
+
+		iput(toput_inode);
+		toput_inode = inode;
+		error = myfs_mig_one(m, inode);
+		if (error)
+			goto out;
+
+		cond_resched();
+		spin_lock(&sb->s_inode_list_lock);
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+
+	s = myfs_mig_rec(m, MYFS_MIG_END, 0, 0);
+	error = IS_ERR(s) ? PTR_ERR(s) : myfs_mig_flush(m);
+out:
+	iput(toput_inode);
+	return error;
+}
+
+static long myfs_ioc_migrate(struct file *filp, struct myfs_migrate __user *arg)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_mig m = {};
+	struct myfs_migrate req;
+	struct timespec64 start;
+	int error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+	if (req.flags || req.__reserved || req.pass > MYFS_MIGRATE_FINAL)
+		return -EINVAL;
+	m.out = fget(req.fd);
+	if (!m.out)
+		return -EBADF;
+	error = -EBADF;
+	if (!(m.out->f_mode & FMODE_WRITE))
+		goto out_fput;
+	/* writing to ourselves would block forever in the FINAL pass */
+	error = -EINVAL;
+	if (file_inode(m.out)->i_sb == sb)
+		goto out_fput;
+	error = -ENOMEM;
+	/* plus room to remember a name in myfs_mig_dir() */
+	m.buf = kvmalloc(MYFS_MIG_BUF + NAME_MAX + 1, GFP_KERNEL);
+	if (!m.buf)
+		goto out_fput;
+
+	mutex_lock(&fsi->mig_mutex);
+	error = -EINVAL;
+	if (req.pass != MYFS_MIGRATE_FULL && !fsi->mig_active)
+		goto out_unlock;
+	if (req.pass == MYFS_MIGRATE_FINAL) {
+		error = freeze_super(sb);
+		if (error)
+			goto out_unlock;
+	}
+	m.full = req.pass == MYFS_MIGRATE_FULL;
+	m.since = fsi->mig_since;
+	ktime_get_coarse_real_ts64(&start);
+	WRITE_ONCE(fsi->mig_active, true);
+
+	error = myfs_mig_send(&m, sb, req.pass);
+	if (error || req.pass == MYFS_MIGRATE_FINAL)
+		WRITE_ONCE(fsi->mig_active, false);
+	else
+		fsi->mig_since = start;
+	if (error && req.pass == MYFS_MIGRATE_FINAL)
+		thaw_super(sb);
+out_unlock:
+	mutex_unlock(&fsi->mig_mutex);
+	kvfree(m.buf);
+	if (!error) {
+		req.inodes = m.stats.inodes;
+		req.dirs = m.stats.dirs;
+		req.pages = m.stats.pages;
+		req.bytes = m.stats.bytes;
+		if (copy_to_user(arg, &req, sizeof(req)))
+			error = -EFAULT;
+	}
+out_fput:
+	fput(m.out);
+	return error;
+}
+
+static long myfs_dir_ioctl(struct file *filp, unsigned int cmd,
+			   unsigned long arg)
+{
+	switch (cmd) {
+	case MYFS_IOC_COMMIT:
+		return myfs_ioc_commit(filp, (void __user *)arg);
+	case MYFS_IOC_LIST_RANGE:
+		return myfs_ioc_list_range(filp, (void __user *)arg);
+	case MYFS_IOC_MIGRATE_SEND:
+		return myfs_ioc_migrate(filp, (void __user *)arg);
+	case MYFS_IOC_SET_TTL:
+	case MYFS_IOC_GET_TTL:
+		return myfs_ioc_ttl(filp, cmd, (u64 __user *)arg);
+	}
+	return -ENOTTY;
+}
+
+static const struct file_operations myfs_dir_operations = {
+	.open		= dcache_dir_open,
+	.release	= dcache_dir_close,
+	.llseek		= dcache_dir_lseek,
+	.read		= generic_read_dir,
+	.iterate_shared	= dcache_readdir,
+	.fsync		= noop_fsync,
+	.unlocked_ioctl	= myfs_dir_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+};
+
+/*
+ * Display the mount options in /proc/mounts.
+ */
+static int myfs_show_options(struct seq_file *m, struct dentry *root)
+{
+	struct myfs_fs_info *fsi = root->d_sb->s_fs_info;
+
+	if (fsi->mount_opts.mode != RAMFS_DEFAULT_MODE)
+		seq_printf(m, ",mode=%o", fsi->mount_opts.mode);
+	if (fsi->mount_opts.casefold)
+		seq_puts(m, ",casefold");
+	if (fsi->mount_opts.max_pages)
+		seq_printf(m, ",size=%luk",
+			   fsi->mount_opts.max_pages << (PAGE_SHIFT - 10));
+	if (fsi->mount_opts.lru)
+		seq_puts(m, ",cache=lru");
+	if (fsi->mount_opts.cluster)
+		seq_puts(m, ",cluster");
+	return 0;
+}
+
+static void myfs_inode_info_init(struct myfs_inode_info *mi)
+{
+	atomic_set(&mi->lock_contended, 0);
+	atomic64_set(&mi->lock_time_ns, 0);
+	mi->heat = 0;
+	mi->heat_epoch = jiffies / MYFS_HEAT_HALFLIFE;
+	mi->seals = 0;
+	RCU_INIT_POINTER(mi->xattrs, NULL);
+	mi->blkdev = NULL;
+	mi->dirents = RB_ROOT;
+	mi->ttl = 0;
+	mi->expires = 0;
+	INIT_LIST_HEAD(&mi->ttl_node);
+	mi->ttl_cred = NULL;
+	mi->ttl_userns = NULL;
+	mi->nr_accounted = 0;
+	INIT_LIST_HEAD(&mi->lru_node);
+	mi->lru_ref = false;
+	mi->lru_pinned = false;
+	mi->purge = 0;
+	INIT_LIST_HEAD(&mi->purge_node);
+	mi->purge_counted = 0;
+	mi->mig_trunc = U64_MAX;
+	mi->cluster_home = NULL;
+	mi->cluster = NULL;
+	seqcount_init(&mi->write_seq);
+	mi->untorn_buf = NULL;
+}
+
+static struct inode *myfs_alloc_inode(struct super_block *sb)
+{
+	struct myfs_inode_info *mi;
+
+	mi = alloc_inode_sb(sb, myfs_inode_cachep, GFP_KERNEL);
+	if (!mi)
+		return NULL;
+	myfs_inode_info_init(mi);
+	return &mi->vfs_inode;
+}
+
+static void myfs_evict_inode(struct inode *inode)
+{
+	myfs_ttl_cancel(inode);
+	myfs_lru_del(inode);
+	myfs_purge_del(inode);
+	truncate_inode_pages_final(&inode->i_data);
+	myfs_account(inode);
+	kvfree(MYFS_I(inode)->untorn_buf);
+	MYFS_I(inode)->untorn_buf = NULL;
+	clear_inode(inode);
+}
+
+static void myfs_free_inode(struct inode *inode)
+{
+	struct myfs_inode_info *mi = MYFS_I(inode);
+
+	/* already after a grace period */
+	myfs_xattrs_free(rcu_dereference_protected(mi->xattrs, true));
+	if (S_ISDIR(inode->i_mode))
+		myfs_dirents_free(inode);
+	myfs_cluster_put(mi->cluster);
+	if (mi->cluster_home)
+		myfs_cluster_free(mi);
+	else
+		kmem_cache_free(myfs_inode_cachep, mi);
+}
+
+/*
+ * Freezing.  By the time ->freeze_fs runs, freeze_super() has drained
+ * write(2), metadata operations and ->page_mkwrite.  But pages stay
+ * dirty here, so a shared mapping that already faulted a page writable
+ * can keep storing to it.  Write-protect every mapped page, so that the
+ * next store faults and waits in filemap_page_mkwrite() until the thaw.
+ * Our own writers take sb_start_write too, or only trylock it: the TTL
+ * reaper, the purge shrinker, LRU eviction and myfsb writes.
+ */
+static unsigned long myfs_freeze_mapping(struct address_space *mapping)
+{
+	struct page *pages[PAGEVEC_SIZE];
+	unsigned long wp = 0;
+	pgoff_t index = 0;
+	unsigned int nr, i;
+
+	while ((nr = find_get_pages_range(mapping, &index, (pgoff_t)-1,
+					  PAGEVEC_SIZE, pages))) {
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+
+			if (page_mapped(page)) {
+				lock_page(page);
+				if (page->mapping == mapping && page_mkclean(page))
+					wp++;
+				unlock_page(page);
+			}
+			put_page(page);
+		}
+		cond_resched();
+	}
+	return wp;
+}
+
+static int myfs_freeze_fs(struct super_block *sb)
+{
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct inode *inode, *toput_inode = NULL;
+	u64 start = ktime_get_ns();
+	unsigned long wp = 0;
+
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		spin_lock(&inode->i_lock);
+		if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
+		    !S_ISREG(inode->i_mode) || !mapping_mapped(inode->i_mapping)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&sb->s_inode_list_lock);
+
+		iput(toput_inode);
+		toput_inode = inode;
+		wp += myfs_freeze_mapping(inode->i_mapping);
+
+		cond_resched();
+		spin_lock(&sb->s_inode_list_lock);
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+	iput(toput_inode);
+
+	WRITE_ONCE(fsi->frozen, true);
+	cancel_delayed_work(&fsi->ttl_work);
+
+	fsi->freezes++;
+	fsi->freeze_wp_pages = wp;
+	fsi->frozen_at = ktime_get_ns();
+	fsi->freeze_ns = fsi->frozen_at - start;
+	return 0;
+}
+
+static int myfs_unfreeze_fs(struct super_block *sb)
+{
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+
+	spin_lock(&fsi->ttl_lock);
+	WRITE_ONCE(fsi->frozen, false);
+	myfs_ttl_kick(fsi);
+	spin_unlock(&fsi->ttl_lock);
+
+	fsi->frozen_ns = ktime_get_ns() - fsi->frozen_at;
+	fsi->frozen_ns_max = max(fsi->frozen_ns_max, fsi->frozen_ns);
+	return 0;
+}
+
+static int myfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+	struct myfs_fs_info *fsi = dentry->d_sb->s_fs_info;
+	unsigned long max = fsi->mount_opts.max_pages;
+	s64 used;
+
+	simple_statfs(dentry, buf);
+	if (max) {
+		used = percpu_counter_sum_positive(&fsi->used_pages);
+		buf->f_blocks = max;
+		buf->f_bfree = buf->f_bavail = max - min_t(u64, used, max);
+	}
+	return 0;
+}
+
+static void myfs_inode_init_once(void *foo)
+{
+	struct myfs_inode_info *mi = foo;
+
+	inode_init_once(&mi->vfs_inode);
 }
 
-const struct file_operations myfs_file_operations = {
-	.read_iter	= generic_file_read_iter,
-	.write_iter	= generic_file_write_iter,
-	.mmap		= generic_file_mmap,
-	.fsync		= noop_fsync,
-	.splice_read	= generic_file_splice_read,
-	.splice_write	= iter_file_splice_write,
-	.llseek		= generic_file_llseek,
-	.get_unmapped_area	= myfs_mmu_get_unmapped_area,
+static const struct super_operations myfs_ops = {
+	.alloc_inode	= myfs_alloc_inode,
+	.free_inode	= myfs_free_inode,
+	.evict_inode	= myfs_evict_inode,
+	.statfs		= myfs_statfs,
+	.freeze_fs	= myfs_freeze_fs,
+	.unfreeze_fs	= myfs_unfreeze_fs,
+	.drop_inode	= generic_delete_inode,
+	.show_options	= myfs_show_options,
 };
 
-const struct inode_operations myfs_file_inode_operations = {
-	.setattr	= simple_setattr,
-	.getattr	= simple_getattr,
-};
+/*
+ * Top-N inode listings for debugfs.  Walks sb->s_inodes the way
+ * drop_pagecache_sb() does, holding a reference on the current inode so
+ * the list lock can be dropped, and keeps a reference on every inode
+ * that is in @top.  Release them with myfs_top_release().
+ */
+#define MYFS_TOP_N	16
 
-struct myfs_mount_opts {
-	umode_t mode;
+struct myfs_top_entry {
+	struct inode	*inode;
+	u64		key;
 };
 
-struct myfs_fs_info {
-	struct myfs_mount_opts mount_opts;
-};
+static int myfs_top_collect(struct super_block *sb, struct myfs_top_entry *top,
+			    int n, u64 (*key)(struct inode *), bool coldest)
+{
+	struct inode *inode, *toput_inode = NULL;
+	int nr = 0;
 
-#define RAMFS_DEFAULT_MODE	0755
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		struct inode *victim = NULL;
+		u64 k;
+		int i;
 
-static const struct super_operations myfs_ops;
-static const struct inode_operations myfs_dir_inode_operations;
+		spin_lock(&inode->i_lock);
+		if (inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&sb->s_inode_list_lock);
+
+		k = key(inode);
+		if (k != U64_MAX && (nr < n || (coldest ? k < top[n - 1].key
+							: k > top[n - 1].key))) {
+			i = nr;
+			if (nr == n)
+				victim = top[--i].inode;
+			else
+				nr++;
+			for (; i > 0; i--) {
+				if (coldest ? k >= top[i - 1].key
+					    : k <= top[i - 1].key)
+					break;
+				top[i] = top[i - 1];
+			}
+			ihold(inode);
+			top[i].inode = inode;
+			top[i].key = k;
+		}
+
+		iput(victim);
+		iput(toput_inode);
+		toput_inode = inode;
+
+		cond_resched();
+		spin_lock(&sb->s_inode_list_lock);
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+	iput(toput_inode);
+	return nr;
+}
 
-struct inode *myfs_get_inode(struct super_block *sb,
-				const struct inode *dir, umode_t mode, dev_t dev)
+static void myfs_top_release(struct myfs_top_entry *top, int nr)
 {
-	struct inode * inode = new_inode(sb);
+	while (nr--)
+		iput(top[nr].inode);
+}
 
-	if (inode) {
-		inode->i_ino = get_next_ino();
-		inode_init_owner(&init_user_ns, inode, dir, mode);
-		inode->i_mapping->a_ops = &ram_aops;
-		mapping_set_gfp_mask(inode->i_mapping, GFP_HIGHUSER);
-		mapping_set_unevictable(inode->i_mapping);
-		inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
-		switch (mode & S_IFMT) {
-		default:
-			init_special_inode(inode, mode, dev);
-			break;
-		case S_IFREG:
-			inode->i_op = &myfs_file_inode_operations;
-			inode->i_fop = &myfs_file_operations;
-			break;
-		case S_IFDIR:
-			inode->i_op = &myfs_dir_inode_operations;
-			inode->i_fop = &simple_dir_operations;
+static void myfs_seq_inode_path(struct seq_file *m, struct inode *inode)
+{
+	struct dentry *dentry = d_find_alias(inode);
+	char *buf, *p;
 
-			/* directory inodes start off with i_nlink == 2 (for "." entry) */
-			inc_nlink(inode);
-			break;
-		case S_IFLNK:
-			inode->i_op = &page_symlink_inode_operations;
-			inode_nohighmem(inode);
-			break;
+	if (!dentry) {
+		seq_puts(m, "(unlinked)");
+		return;
+	}
+	buf = __getname();
+	if (buf) {
+		p = dentry_path_raw(dentry, buf, PATH_MAX);
+		seq_puts(m, IS_ERR(p) ? "(unknown)" : p);
+		__putname(buf);
+	}
+	dput(dentry);
+}
+
+static const char * const myfs_lock_names[MYFS_LOCK_NR] = {
+	[MYFS_LOCK_DIR]		= "dir",
+	[MYFS_LOCK_FILE]	= "file",
+	[MYFS_LOCK_MAPPING]	= "mapping",
+};
+
+static int myfs_lock_stat_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_lock_stat sum = {};
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct myfs_lock_stat *st = per_cpu_ptr(fsi->lock_stat, cpu);
+
+		for (i = 0; i < MYFS_LOCK_NR; i++) {
+			sum.acquired[i] += st->acquired[i];
+			sum.contended[i] += st->contended[i];
+			sum.time_ns[i] += st->time_ns[i];
 		}
 	}
-	return inode;
+
+	/* directories record how long they were held, the rest the wait */
+	seq_printf(m, "%-8s %16s %16s %16s %16s\n",
+		   "class", "acquired", "contended", "wait_us", "hold_us");
+	for (i = 0; i < MYFS_LOCK_NR; i++) {
+		u64 us = div_u64(sum.time_ns[i], NSEC_PER_USEC);
+
+		seq_printf(m, "%-8s %16llu %16llu %16llu %16llu\n",
+			   myfs_lock_names[i], sum.acquired[i], sum.contended[i],
+			   i == MYFS_LOCK_DIR ? 0 : us,
+			   i == MYFS_LOCK_DIR ? us : 0);
+	}
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(myfs_lock_stat);
 
-/*
- * File creation. Allocate an inode, and we're done..
- */
-/* SMP-safe */
-static int
-myfs_mknod(struct user_namespace *mnt_userns, struct inode *dir,
-	    struct dentry *dentry, umode_t mode, dev_t dev)
+/* By time while lock timing is on, else by how often it was contended. */
+static u64 myfs_lock_top_key(struct inode *inode)
 {
-	struct inode * inode = myfs_get_inode(dir->i_sb, dir, mode, dev);
-	int error = -ENOSPC;
+	struct myfs_inode_info *mi = MYFS_I(inode);
+	u64 key = myfs_lock_timed() ? atomic64_read(&mi->lock_time_ns) :
+				      atomic_read(&mi->lock_contended);
 
-	if (inode) {
-		d_instantiate(dentry, inode);
-		dget(dentry);	/* Extra count - pin the dentry in core */
-		error = 0;
-		dir->i_mtime = dir->i_ctime = current_time(dir);
+	return key ? key : U64_MAX;
+}
+
+static int myfs_lock_top_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct myfs_top_entry *top;
+	int i, nr;
+
+	top = kcalloc(MYFS_TOP_N, sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+
+	nr = myfs_top_collect(sb, top, MYFS_TOP_N, myfs_lock_top_key, false);
+	/* "time": the wait for a file, how long it was held for a dir */
+	seq_printf(m, "%-12s %-4s %12s %16s  %s\n",
+		   "ino", "type", "contended", "time_us", "path");
+	for (i = 0; i < nr; i++) {
+		struct inode *inode = top[i].inode;
+
+		seq_printf(m, "%-12lu %-4s %12d %16llu  ", inode->i_ino,
+			   S_ISDIR(inode->i_mode) ? "dir" : "file",
+			   atomic_read(&MYFS_I(inode)->lock_contended),
+			   div_u64(atomic64_read(&MYFS_I(inode)->lock_time_ns),
+				   NSEC_PER_USEC));
+		myfs_seq_inode_path(m, inode);
+		seq_putc(m, '\n');
 	}
-	return error;
+	myfs_top_release(top, nr);
+	kfree(top);
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(myfs_lock_top);
 
-static int myfs_mkdir(struct user_namespace *mnt_userns, struct inode *dir,
-		       struct dentry *dentry, umode_t mode)
+static u64 myfs_heat_hot_key(struct inode *inode)
 {
-	int retval = myfs_mknod(&init_user_ns, dir, dentry, mode | S_IFDIR, 0);
-	if (!retval)
-		inc_nlink(dir);
+	unsigned int heat;
 
-	printk(KERN_INFO "myfs: create dir %s success!\n", dentry->d_iname);
-	return retval;
+	if (!S_ISREG(inode->i_mode))
+		return U64_MAX;
+	heat = myfs_inode_heat(inode);
+	return heat ? heat : U64_MAX;
 }
 
-static int myfs_create(struct user_namespace *mnt_userns, struct inode *dir,
-			struct dentry *dentry, umode_t mode, bool excl)
+/* Coldest first; among equally cold files the largest comes first. */
+static u64 myfs_heat_cold_key(struct inode *inode)
 {
-	int ret = 0;
-	ret =  myfs_mknod(&init_user_ns, dir, dentry, mode | S_IFREG, 0);
-	printk(KERN_INFO "myfs: create file %s success!\n", dentry->d_iname);
-	return ret;
+	unsigned long nrpages = READ_ONCE(inode->i_mapping->nrpages);
+
+	if (!S_ISREG(inode->i_mode))
+		return U64_MAX;
+	return (u64)myfs_inode_heat(inode) << 32 |
+	       (u32)~min_t(unsigned long, nrpages, U32_MAX);
 }
 
-static int myfs_symlink(struct user_namespace *mnt_userns, struct inode *dir,
-			 struct dentry *dentry, const char *symname)
+static int myfs_heat_show(struct seq_file *m, bool coldest)
 {
-	struct inode *inode;
-	int error = -ENOSPC;
+	struct super_block *sb = m->private;
+	struct myfs_top_entry *top;
+	int i, nr;
 
-	inode = myfs_get_inode(dir->i_sb, dir, S_IFLNK|S_IRWXUGO, 0);
-	if (inode) {
-		int l = strlen(symname)+1;
-		error = page_symlink(inode, symname, l);
-		if (!error) {
-			d_instantiate(dentry, inode);
-			dget(dentry);
-			dir->i_mtime = dir->i_ctime = current_time(dir);
-		} else
-			iput(inode);
+	top = kcalloc(MYFS_TOP_N, sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+
+	nr = myfs_top_collect(sb, top, MYFS_TOP_N, coldest ?
+			      myfs_heat_cold_key : myfs_heat_hot_key, coldest);
+	seq_printf(m, "%-12s %10s %16s  %s\n", "ino", "heat", "size", "path");
+	for (i = 0; i < nr; i++) {
+		struct inode *inode = top[i].inode;
+
+		seq_printf(m, "%-12lu %10u %16lld  ", inode->i_ino,
+			   myfs_inode_heat(inode), i_size_read(inode));
+		myfs_seq_inode_path(m, inode);
+		seq_putc(m, '\n');
 	}
-	return error;
+	myfs_top_release(top, nr);
+	kfree(top);
+	return 0;
 }
 
-static int myfs_tmpfile(struct user_namespace *mnt_userns,
-			 struct inode *dir, struct dentry *dentry, umode_t mode)
+static int myfs_heat_hot_show(struct seq_file *m, void *v)
 {
-	struct inode *inode;
+	return myfs_heat_show(m, false);
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_heat_hot);
 
-	inode = myfs_get_inode(dir->i_sb, dir, mode, 0);
-	if (!inode)
-		return -ENOSPC;
-	d_tmpfile(dentry, inode);
+static int myfs_heat_cold_show(struct seq_file *m, void *v)
+{
+	return myfs_heat_show(m, true);
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_heat_cold);
+
+/*
+ * "qos": write "<cgroup id> <metadata ops/s> <bytes/s>" to set the rule
+ * for a cgroup (the id is the inode number of its cgroupfs directory;
+ * 0 means unlimited, both 0 removes the rule).  Reading lists the rules
+ * and how often they throttled or rejected callers.
+ */
+static int myfs_qos_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_qos_rule *rule;
+	int bkt;
+
+	seq_printf(m, "%-20s %14s %16s %12s %14s %12s\n", "cgroup", "ops_per_sec",
+		   "bytes_per_sec", "throttled", "throttled_ms", "rejected");
+	mutex_lock(&fsi->qos_mutex);
+	hash_for_each(fsi->qos_rules, bkt, rule, node)
+		seq_printf(m, "%-20llu %14llu %16llu %12lld %14lld %12lld\n",
+			   rule->cgid, rule->bucket[MYFS_QOS_OPS].rate,
+			   rule->bucket[MYFS_QOS_BYTES].rate,
+			   atomic64_read(&rule->throttled),
+			   atomic64_read(&rule->throttled_ns) / NSEC_PER_MSEC,
+			   atomic64_read(&rule->rejected));
+	mutex_unlock(&fsi->qos_mutex);
 	return 0;
 }
 
-static const struct inode_operations myfs_dir_inode_operations = {
-	.create		= myfs_create,
-	.lookup		= simple_lookup,
-	.link		= simple_link,
-	.unlink		= simple_unlink,
-	.symlink	= myfs_symlink,
-	.mkdir		= myfs_mkdir,
-	.rmdir		= simple_rmdir,
-	.mknod		= myfs_mknod,
-	.rename		= simple_rename,
-	.tmpfile	= myfs_tmpfile,
+static int myfs_qos_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, myfs_qos_show, inode->i_private);
+}
+
+static ssize_t myfs_qos_write(struct file *file, const char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct super_block *sb = file_inode(file)->i_private;
+	u64 cgid, ops, bytes;
+	char buf[96];
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	if (sscanf(buf, "%llu %llu %llu", &cgid, &ops, &bytes) != 3)
+		return -EINVAL;
+
+	ret = myfs_qos_set(sb->s_fs_info, cgid, ops, bytes);
+	return ret ? ret : count;
+}
+
+static const struct file_operations myfs_qos_fops = {
+	.owner		= THIS_MODULE,
+	.open		= myfs_qos_open,
+	.read		= seq_read,
+	.write		= myfs_qos_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
 };
 
+static int myfs_ttl_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	unsigned long armed;
+	u64 expired, reaped, failed;
+
+	spin_lock(&fsi->ttl_lock);
+	armed = fsi->ttl_nr;
+	expired = fsi->ttl_expired_total;
+	reaped = fsi->ttl_reaped;
+	failed = fsi->ttl_failed;
+	spin_unlock(&fsi->ttl_lock);
+
+	seq_printf(m, "armed %lu\nexpired %llu\nreaped %llu\nfailed %llu\n",
+		   armed, expired, reaped, failed);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_ttl);
+
+static int myfs_cache_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	unsigned long files, purgeable;
+	u64 evicted, evicted_pages, nospc, purged, purged_pages;
+
+	spin_lock(&fsi->lru_lock);
+	files = fsi->lru_nr;
+	evicted = fsi->lru_evicted;
+	evicted_pages = fsi->lru_evicted_pages;
+	nospc = fsi->lru_nospc;
+	purgeable = fsi->purge_nr;
+	purged = fsi->purged;
+	purged_pages = fsi->purged_pages;
+	spin_unlock(&fsi->lru_lock);
+
+	seq_printf(m, "used_pages %lld\nmax_pages %lu\nlru_files %lu\n"
+		   "evicted %llu\nevicted_pages %llu\nnospc %llu\n",
+		   percpu_counter_sum(&fsi->used_pages),
+		   fsi->mount_opts.max_pages, files, evicted, evicted_pages,
+		   nospc);
+	seq_printf(m, "purgeable %lu\npurged %llu\npurged_pages %llu\n",
+		   purgeable, purged, purged_pages);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_cache);
 /*
- * Display the mount options in /proc/mounts.
+ * "usage": inodes, file bytes and resident pages per owner, one pass over
+ * the superblock's inode list.  Owners past the first MYFS_USAGE_UIDS are
+ * folded into a final "other" line.
  */
-static int myfs_show_options(struct seq_file *m, struct dentry *root)
+#define MYFS_USAGE_BITS	8
+#define MYFS_USAGE_UIDS	(1 << MYFS_USAGE_BITS)
+
+struct myfs_usage {
+	kuid_t	uid;
+	bool	used;
+	u64	inodes;
+	u64	bytes;
+	u64	pages;
+};
+
+static void myfs_usage_add(struct myfs_usage *u, struct inode *inode)
 {
-	struct myfs_fs_info *fsi = root->d_sb->s_fs_info;
+	u->inodes++;
+	if (S_ISREG(inode->i_mode))
+		u->bytes += i_size_read(inode);
+	u->pages += READ_ONCE(inode->i_mapping->nrpages);
+}
 
-	if (fsi->mount_opts.mode != RAMFS_DEFAULT_MODE)
-		seq_printf(m, ",mode=%o", fsi->mount_opts.mode);
+static struct myfs_usage *myfs_usage_slot(struct myfs_usage *tab, kuid_t uid)
+{
+	u32 h = hash_32(__kuid_val(uid), MYFS_USAGE_BITS);
+	int i;
+
+	for (i = 0; i < MYFS_USAGE_UIDS; i++) {
+		struct myfs_usage *u = &tab[(h + i) & (MYFS_USAGE_UIDS - 1)];
+
+		if (!u->used) {
+			u->used = true;
+			u->uid = uid;
+			return u;
+		}
+		if (uid_eq(u->uid, uid))
+			return u;
+	}
+	return NULL;
+}
+
+static int myfs_usage_cmp(const void *a, const void *b)
+{
+	const struct myfs_usage *ua = a, *ub = b;
+
+	if (ua->used != ub->used)
+		return ua->used ? -1 : 1;
+	if (uid_lt(ua->uid, ub->uid))
+		return -1;
+	return uid_gt(ua->uid, ub->uid);
+}
+
+static int myfs_usage_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct myfs_usage *tab, *u, other = { };
+	struct inode *inode, *toput_inode = NULL;
+	int i;
+
+	tab = kvcalloc(MYFS_USAGE_UIDS, sizeof(*tab), GFP_KERNEL);
+	if (!tab)
+		return -ENOMEM;
+
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		spin_lock(&inode->i_lock);
+		if (inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&sb->s_inode_list_lock);
+
+		u = myfs_usage_slot(tab, inode->i_uid);
+		myfs_usage_add(u ? u : &other, inode);
+
+		iput(toput_inode);
+		toput_inode = inode;
+		cond_resched();
+		spin_lock(&sb->s_inode_list_lock);
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+	iput(toput_inode);
+
+	sort(tab, MYFS_USAGE_UIDS, sizeof(*tab), myfs_usage_cmp, NULL);
+	seq_printf(m, "%-12s %12s %20s %16s\n", "uid", "inodes", "bytes", "pages");
+	for (i = 0; i < MYFS_USAGE_UIDS && tab[i].used; i++)
+		seq_printf(m, "%-12u %12llu %20llu %16llu\n",
+			   from_kuid_munged(seq_user_ns(m), tab[i].uid),
+			   tab[i].inodes, tab[i].bytes, tab[i].pages);
+	if (other.inodes)
+		seq_printf(m, "%-12s %12llu %20llu %16llu\n", "other",
+			   other.inodes, other.bytes, other.pages);
+	kvfree(tab);
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(myfs_usage);
 
-static const struct super_operations myfs_ops = {
-	.statfs		= simple_statfs,
-	.drop_inode	= generic_delete_inode,
-	.show_options	= myfs_show_options,
+static int myfs_freeze_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+
+	/* racy against a freeze in progress, which is fine for stats */
+	seq_printf(m, "frozen %d\nfreezes %llu\nlast_wp_pages %llu\n"
+		   "last_freeze_fs_us %llu\nlast_frozen_us %llu\n"
+		   "max_frozen_us %llu\n",
+		   READ_ONCE(fsi->frozen), fsi->freezes, fsi->freeze_wp_pages,
+		   div_u64(fsi->freeze_ns, NSEC_PER_USEC),
+		   div_u64(fsi->frozen_ns, NSEC_PER_USEC),
+		   div_u64(fsi->frozen_ns_max, NSEC_PER_USEC));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_freeze);
+
+static int myfs_hints_show(struct seq_file *m, void *v)
+{
+	static const char * const names[MYFS_POOL_NR] = { "short", "long" };
+	struct super_block *sb = m->private;
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	struct myfs_page_pool *pool;
+	u64 blocks, pages, fallbacks;
+	unsigned int left;
+	int i;
+
+	seq_printf(m, "block_order %d\n", MYFS_POOL_ORDER);
+	for (i = 0; i < MYFS_POOL_NR; i++) {
+		pool = &fsi->pools[i];
+		spin_lock(&pool->lock);
+		blocks = pool->blocks;
+		pages = pool->pages;
+		fallbacks = pool->fallbacks;
+		left = pool->left;
+		spin_unlock(&pool->lock);
+		seq_printf(m, "%s_blocks %llu\n%s_pages %llu\n%s_fallbacks %llu\n"
+			   "%s_idle %u\n", names[i], blocks, names[i], pages,
+			   names[i], fallbacks, names[i], left);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_hints);
+
+/* "lock_timing" at the top of myfs's debugfs: 1 or 0, for all mounts. */
+static ssize_t myfs_lock_timing_read(struct file *file, char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	char buf[2] = { myfs_lock_timed() ? '1' : '0', '\n' };
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, sizeof(buf));
+}
+
+static ssize_t myfs_lock_timing_write(struct file *file,
+				      const char __user *ubuf, size_t count,
+				      loff_t *ppos)
+{
+	bool on;
+	int ret;
+
+	ret = kstrtobool_from_user(ubuf, count, &on);
+	if (ret)
+		return ret;
+	if (on)
+		static_branch_enable(&myfs_lock_timing);
+	else
+		static_branch_disable(&myfs_lock_timing);
+	return count;
+}
+
+static const struct file_operations myfs_lock_timing_fops = {
+	.owner		= THIS_MODULE,
+	.read		= myfs_lock_timing_read,
+	.write		= myfs_lock_timing_write,
+	.llseek		= default_llseek,
 };
 
+static void myfs_debugfs_init(struct super_block *sb)
+{
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+	char name[32];
+
+	snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+	fsi->debugfs = debugfs_create_dir(name, myfs_debugfs_root);
+	debugfs_create_file("lock_stat", 0444, fsi->debugfs, sb,
+			    &myfs_lock_stat_fops);
+	debugfs_create_file("lock_top", 0444, fsi->debugfs, sb,
+			    &myfs_lock_top_fops);
+	debugfs_create_file("heat_hot", 0444, fsi->debugfs, sb,
+			    &myfs_heat_hot_fops);
+	debugfs_create_file("heat_cold", 0444, fsi->debugfs, sb,
+			    &myfs_heat_cold_fops);
+	debugfs_create_file("qos", 0600, fsi->debugfs, sb, &myfs_qos_fops);
+	debugfs_create_file("ttl", 0444, fsi->debugfs, sb, &myfs_ttl_fops);
+	debugfs_create_file("cache", 0444, fsi->debugfs, sb, &myfs_cache_fops);
+	debugfs_create_file("freeze", 0444, fsi->debugfs, sb, &myfs_freeze_fops);
+	debugfs_create_file("hints", 0444, fsi->debugfs, sb, &myfs_hints_fops);
+	debugfs_create_file("usage", 0444, fsi->debugfs, sb, &myfs_usage_fops);
+}
+
 enum myfs_param {
 	Opt_mode,
+	Opt_casefold,
+	Opt_size,
+	Opt_cache,
+	Opt_cluster,
+};
+
+static const struct constant_table myfs_param_cache[] = {
+	{"none",	false},
+	{"lru",		true},
+	{}
 };
 
 const struct fs_parameter_spec myfs_fs_parameters[] = {
 	fsparam_u32oct("mode",	Opt_mode),
+	fsparam_flag("casefold",	Opt_casefold),
+	fsparam_string("size",	Opt_size),
+	fsparam_enum("cache",	Opt_cache, myfs_param_cache),
+	fsparam_flag_no("cluster",	Opt_cluster),
 	{}
 };
 
@@ -203,6 +5180,8 @@ static int myfs_parse_param(struct fs_context *fc, struct fs_parameter *param)
 {
 	struct fs_parse_result result;
 	struct myfs_fs_info *fsi = fc->s_fs_info;
+	unsigned long long size;
+	char *rest;
 	int opt;
 
 	opt = fs_parse(fc, myfs_fs_parameters, param, &result);
@@ -222,6 +5201,21 @@ static int myfs_parse_param(struct fs_context *fc, struct fs_parameter *param)
 	case Opt_mode:
 		fsi->mount_opts.mode = result.uint_32 & S_IALLUGO;
 		break;
+	case Opt_casefold:
+		fsi->mount_opts.casefold = true;
+		break;
+	case Opt_size:
+		size = memparse(param->string, &rest);
+		if (*rest || !size)
+			return invalfc(fc, "Bad value for size");
+		fsi->mount_opts.max_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+		break;
+	case Opt_cache:
+		fsi->mount_opts.lru = result.uint_32;
+		break;
+	case Opt_cluster:
+		fsi->mount_opts.cluster = !result.negated;
+		break;
 	}
 
 	return 0;
@@ -232,18 +5226,45 @@ static int myfs_fill_super(struct super_block *sb, struct fs_context *fc)
 	struct myfs_fs_info *fsi = sb->s_fs_info;
 	struct inode *inode;
 
+	fsi->sb			= sb;
 	sb->s_maxbytes		= MAX_LFS_FILESIZE;
 	sb->s_blocksize		= PAGE_SIZE;
 	sb->s_blocksize_bits	= PAGE_SHIFT;
 	sb->s_magic		= RAMFS_MAGIC;
 	sb->s_op		= &myfs_ops;
+	sb->s_d_op		= &myfs_dentry_operations;
+	sb->s_xattr		= myfs_xattr_handlers;
 	sb->s_time_gran		= 1;
 
-	inode = myfs_get_inode(sb, NULL, S_IFDIR | fsi->mount_opts.mode, 0);
+	if (fsi->mount_opts.lru && !fsi->mount_opts.max_pages)
+		return invalf(fc, "myfs: cache=lru needs size=");
+
+	if (fsi->mount_opts.casefold) {
+#if IS_ENABLED(CONFIG_UNICODE)
+		struct unicode_map *encoding = utf8_load(MYFS_UTF8_VERSION);
+
+		if (IS_ERR(encoding))
+			return invalf(fc, "myfs: cannot load utf8 tables");
+		sb->s_encoding = encoding;
+		sb->s_d_op = &myfs_ci_dentry_operations;
+#else
+		return invalf(fc, "myfs: casefold needs CONFIG_UNICODE");
+#endif
+	}
+
+	inode = myfs_get_inode(&init_user_ns, sb, NULL,
+			       S_IFDIR | fsi->mount_opts.mode, 0);
 	sb->s_root = d_make_root(inode);
 	if (!sb->s_root)
 		return -ENOMEM;
 
+	fsi->purge_shrinker.count_objects = myfs_purge_count;
+	fsi->purge_shrinker.scan_objects = myfs_purge_scan;
+	fsi->purge_shrinker.seeks = DEFAULT_SEEKS;
+	if (register_shrinker(&fsi->purge_shrinker))
+		return -ENOMEM;
+
+	myfs_debugfs_init(sb);
 	return 0;
 }
 
@@ -252,9 +5273,20 @@ static int myfs_get_tree(struct fs_context *fc)
 	return get_tree_nodev(fc, myfs_fill_super);
 }
 
+static void myfs_free_fsi(struct myfs_fs_info *fsi)
+{
+	if (!fsi)
+		return;
+	myfs_qos_clear(fsi);
+	myfs_pools_release(fsi);
+	percpu_counter_destroy(&fsi->used_pages);
+	free_percpu(fsi->lock_stat);
+	kfree(fsi);
+}
+
 static void myfs_free_fc(struct fs_context *fc)
 {
-	kfree(fc->s_fs_info);
+	myfs_free_fsi(fc->s_fs_info);
 }
 
 static const struct fs_context_operations myfs_context_ops = {
@@ -266,10 +5298,33 @@ static const struct fs_context_operations myfs_context_ops = {
 int myfs_init_fs_context(struct fs_context *fc)
 {
 	struct myfs_fs_info *fsi;
+	int i;
 
 	fsi = kzalloc(sizeof(*fsi), GFP_KERNEL);
 	if (!fsi)
 		return -ENOMEM;
+	fsi->lock_stat = alloc_percpu(struct myfs_lock_stat);
+	if (!fsi->lock_stat) {
+		kfree(fsi);
+		return -ENOMEM;
+	}
+	if (percpu_counter_init(&fsi->used_pages, 0, GFP_KERNEL)) {
+		free_percpu(fsi->lock_stat);
+		kfree(fsi);
+		return -ENOMEM;
+	}
+	hash_init(fsi->qos_rules);
+	mutex_init(&fsi->qos_mutex);
+	init_waitqueue_head(&fsi->commit_wq);
+	myfs_ttl_init(fsi);
+	spin_lock_init(&fsi->lru_lock);
+	INIT_LIST_HEAD(&fsi->lru_list);
+	init_llist_head(&fsi->lru_iput);
+	INIT_WORK(&fsi->lru_iput_work, myfs_lru_iput_work);
+	INIT_LIST_HEAD(&fsi->purge_list);
+	mutex_init(&fsi->mig_mutex);
+	for (i = 0; i < MYFS_POOL_NR; i++)
+		spin_lock_init(&fsi->pools[i].lock);
 
 	fsi->mount_opts.mode = RAMFS_DEFAULT_MODE;
 	fc->s_fs_info = fsi;
@@ -279,8 +5334,18 @@ int myfs_init_fs_context(struct fs_context *fc)
 
 static void myfs_kill_sb(struct super_block *sb)
 {
-	kfree(sb->s_fs_info);
+	struct myfs_fs_info *fsi = sb->s_fs_info;
+
+	debugfs_remove_recursive(fsi->debugfs);
+	cancel_delayed_work_sync(&fsi->ttl_work);
+	unregister_shrinker(&fsi->purge_shrinker);
+	/* no writers left to queue more */
+	flush_work(&fsi->lru_iput_work);
 	kill_litter_super(sb);
+#if IS_ENABLED(CONFIG_UNICODE)
+	utf8_unload(sb->s_encoding);
+#endif
+	myfs_free_fsi(fsi);
 }
 
 static struct file_system_type myfs_fs_type = {
@@ -289,20 +5354,77 @@ static struct file_system_type myfs_fs_type = {
 	.init_fs_context = myfs_init_fs_context,
 	.parameters	= myfs_fs_parameters,
 	.kill_sb	= myfs_kill_sb,
-	.fs_flags	= FS_USERNS_MOUNT,
+	.fs_flags	= FS_USERNS_MOUNT | FS_ALLOW_IDMAP,
 };
 
 static int __init init_myfs_fs(void)
 {
 	int ret;
+
+	myfs_inode_cachep = kmem_cache_create("myfs_inode_cache",
+				sizeof(struct myfs_inode_info), 0,
+				SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD |
+				SLAB_ACCOUNT, myfs_inode_init_once);
+	if (!myfs_inode_cachep)
+		return -ENOMEM;
+
+	myfs_cluster_slots = min_t(size_t, BITS_PER_LONG,
+			(MYFS_CLUSTER_SIZE - sizeof(struct myfs_cluster)) /
+			sizeof(struct myfs_inode_info));
+	myfs_cluster_cachep = kmem_cache_create("myfs_inode_cluster",
+				MYFS_CLUSTER_SIZE, 0,
+				SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, NULL);
+	if (!myfs_cluster_cachep) {
+		kmem_cache_destroy(myfs_inode_cachep);
+		return -ENOMEM;
+	}
+
+	myfs_aops = ram_aops;
+	myfs_aops.write_begin = myfs_write_begin;
+	myfs_aops.write_end = myfs_write_end;
+
+	ret = -ENOMEM;
+	myfs_populate_wq = alloc_workqueue("myfs_populate", WQ_UNBOUND, 0);
+	if (!myfs_populate_wq)
+		goto out_cache;
+
+	myfs_blkdev_major = register_blkdev(0, "myfsb");
+	if (myfs_blkdev_major < 0) {
+		ret = myfs_blkdev_major;
+		goto out_wq;
+	}
+
+	myfs_debugfs_root = debugfs_create_dir("myfs", NULL);
+	debugfs_create_file("lock_timing", 0600, myfs_debugfs_root, NULL,
+			    &myfs_lock_timing_fops);
+
 	ret = register_filesystem(&myfs_fs_type);
+	if (ret)
+		goto out_debugfs;
 	printk(KERN_INFO "myfs: install myfs success!\n");
+	return 0;
+
+out_debugfs:
+	debugfs_remove_recursive(myfs_debugfs_root);
+	unregister_blkdev(myfs_blkdev_major, "myfsb");
+out_wq:
+	destroy_workqueue(myfs_populate_wq);
+out_cache:
+	kmem_cache_destroy(myfs_cluster_cachep);
+	kmem_cache_destroy(myfs_inode_cachep);
 	return ret;
 }
 
 static void __exit exit_myfs_fs(void)
 {
      unregister_filesystem(&myfs_fs_type);
+	debugfs_remove_recursive(myfs_debugfs_root);
+	unregister_blkdev(myfs_blkdev_major, "myfsb");
+	destroy_workqueue(myfs_populate_wq);
+	/* make sure all delayed rcu free inodes are flushed */
+	rcu_barrier();
+	kmem_cache_destroy(myfs_cluster_cachep);
+	kmem_cache_destroy(myfs_inode_cachep);
 	 printk(KERN_INFO "myfs: uninstall myfs success!\n");
 }
 
@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * myfs ioctl interface, shared with userspace tools.
+ */
+#ifndef _MYFS_H
+#define _MYFS_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define MYFS_IOC_MAGIC		'y'
+
+/*
+ * MYFS_IOC_COMMIT, on any directory of the mount: link every source
+ * inode at its destination name, all at once or not at all.  Concurrent
+ * lookups and readdir see either none or all of the new names.
+ *
+ * The source is @src_fd (an O_TMPFILE or any other myfs file) or, if
+ * @src_fd is negative, the path at @src_path.  As with linkat() and
+ * AT_EMPTY_PATH, an @src_fd other than a linkable O_TMPFILE needs
+ * CAP_DAC_READ_SEARCH, and an unlinked source fails with ENOENT.
+ * The destination is @name
+ * in the directory open as @dst_dirfd, which must be on the same mount.
+ * An existing destination is an error unless MYFS_COMMIT_REPLACE is set,
+ * and replacing one something is mounted on fails with EBUSY.
+ */
+#define MYFS_COMMIT_REPLACE	0x1
+#define MYFS_COMMIT_MAX		1024
+
+struct myfs_commit_entry {
+	__s32	src_fd;
+	__s32	dst_dirfd;
+	__u32	flags;
+	__u32	__reserved;
+	__u64	src_path;	/* const char * */
+	char	name[256];
+};
+
+struct myfs_commit {
+	__u32	nr;
+	__u32	flags;		/* must be 0 */
+	__u64	entries;	/* struct myfs_commit_entry[nr] */
+};
+
+#define MYFS_IOC_COMMIT		_IOW(MYFS_IOC_MAGIC, 1, struct myfs_commit)
+
+/*
+ * Seals on a regular file: the F_SEAL_* bits of <linux/fcntl.h>, with
+ * the semantics fcntl(F_ADD_SEALS) has for memfds.
+ */
+#define MYFS_IOC_ADD_SEALS	_IOW(MYFS_IOC_MAGIC, 2, __u32)
+#define MYFS_IOC_GET_SEALS	_IOR(MYFS_IOC_MAGIC, 3, __u32)
+
+/*
+ * Export a regular file as the block device /dev/myfsbN, N returned in
+ * the argument, or remove the file's device.  The file's size must be a
+ * multiple of 512 and cannot change while the device exists; a file
+ * opened read-only or write-sealed gives a read-only disk.
+ */
+#define MYFS_IOC_BLKDEV_ADD	_IOR(MYFS_IOC_MAGIC, 4, __u32)
+#define MYFS_IOC_BLKDEV_DEL	_IO(MYFS_IOC_MAGIC, 5)
+
+/*
+ * MYFS_IOC_LIST_RANGE, on a directory: list its entries in byte order,
+ * starting after @marker, keeping only names that begin with @prefix.
+ * With a non-zero @delimiter, names with the delimiter somewhere after
+ * the prefix are collapsed into one MYFS_LIST_PREFIX entry holding the
+ * name up to and including the delimiter (S3 CommonPrefixes).
+ *
+ * Records of struct myfs_list_entry are packed into @buf, each
+ * @rec_len bytes long.  If the listing did not fit (or hit
+ * @max_entries) @truncated is set and the last name returned is copied
+ * to @next_marker (NAME_MAX + 1 bytes); pass it back as @marker to
+ * continue.  A marker that ends in the delimiter skips every name under
+ * that prefix.
+ */
+#define MYFS_LIST_PREFIX	0xff	/* myfs_list_entry.type */
+
+struct myfs_list_entry {
+	__u64	ino;		/* 0 for MYFS_LIST_PREFIX */
+	__u32	rec_len;
+	__u16	name_len;
+	__u8	type;		/* DT_* or MYFS_LIST_PREFIX */
+	__u8	__pad;
+	char	name[];		/* NUL terminated */
+};
+
+struct myfs_list_range {
+	__u64	prefix;		/* const char *, or 0 */
+	__u64	marker;		/* const char *, or 0 */
+	__u64	buf;
+	__u64	next_marker;	/* char[NAME_MAX + 1], out */
+	__u32	prefix_len;
+	__u32	marker_len;
+	__u32	buf_len;
+	__u32	max_entries;	/* 0 for no limit */
+	__u32	delimiter;	/* a byte value, 0 for none */
+	__u32	flags;		/* must be 0 */
+	__u32	nr_entries;	/* out */
+	__u32	truncated;	/* out */
+};
+
+#define MYFS_IOC_LIST_RANGE	_IOWR(MYFS_IOC_MAGIC, 6, struct myfs_list_range)
+
+/*
+ * Time to live in seconds.  On a regular file: unlink it (every name)
+ * that long from now, 0 to disarm; GET returns the time left.  On a
+ * directory: the TTL given to files and directories created in it.
+ * Names are unlinked as the task that armed the file (or created it, for
+ * an inherited TTL); a name it could not have removed itself stays.
+ */
+#define MYFS_IOC_SET_TTL	_IOW(MYFS_IOC_MAGIC, 7, __u64)
+#define MYFS_IOC_GET_TTL	_IOR(MYFS_IOC_MAGIC, 8, __u64)
+
+/*
+ * On a cache=lru mount, a pinned file is never unlinked to make room.
+ * The argument is 1 to pin, 0 to unpin.
+ */
+#define MYFS_IOC_SET_LRU_PIN	_IOW(MYFS_IOC_MAGIC, 9, __u32)
+#define MYFS_IOC_GET_LRU_PIN	_IOR(MYFS_IOC_MAGIC, 10, __u32)
+
+/*
+ * Purgeable files, as with ashmem.  After MYFS_IOC_PURGE_UNPIN the
+ * kernel may drop the file's contents under memory pressure.  A purged
+ * file fails reads and writes with ENODATA, and faults on its mappings
+ * raise SIGBUS, until MYFS_IOC_PURGE_PIN.  PIN returns
+ * MYFS_PURGE_WAS_PURGED if the contents are gone; the file keeps its
+ * size, reads as zeros and should be regenerated.
+ */
+#define MYFS_PURGE_NOT_PURGED	0
+#define MYFS_PURGE_WAS_PURGED	1
+
+#define MYFS_IOC_PURGE_UNPIN	_IO(MYFS_IOC_MAGIC, 11)
+#define MYFS_IOC_PURGE_PIN	_IO(MYFS_IOC_MAGIC, 12)
+
+/*
+ * Live migration, on any directory of the mount (CAP_SYS_ADMIN).  Each
+ * call writes one pass to @fd as a stream of records.  FULL sends
+ * everything and starts tracking changes; DELTA sends what changed
+ * since the previous pass began; FINAL does the same with the mount
+ * frozen and stops tracking.  A FINAL pass that succeeds returns with
+ * the mount still frozen, so nothing changes before the caller has
+ * switched over to the copy; FITHAW releases it.  @fd must not be on
+ * the mount itself.  A failed pass stops tracking, so the next one has
+ * to be FULL; a failed FINAL pass thaws the mount.
+ */
+#define MYFS_MIGRATE_FULL	0
+#define MYFS_MIGRATE_DELTA	1
+#define MYFS_MIGRATE_FINAL	2
+
+struct myfs_migrate {
+	__s32	fd;
+	__u32	pass;		/* MYFS_MIGRATE_* */
+	__u32	flags;		/* must be 0 */
+	__u32	__reserved;
+	__u64	inodes;		/* out: records sent, by type */
+	__u64	dirs;
+	__u64	pages;
+	__u64	bytes;		/* out: length of the pass */
+};
+
+#define MYFS_IOC_MIGRATE_SEND	_IOWR(MYFS_IOC_MAGIC, 13, struct myfs_migrate)
+
+/*
+ * The stream, in host byte order: records of a header and @len bytes
+ * of payload, padded to a multiple of 8.  A pass is START, then for
+ * each changed inode an INODE record followed by its DIR or DATA
+ * records, then END.  A directory's listing is complete: names missing
+ * from it were removed.
+ */
+#define MYFS_MIG_MAGIC		0x6d79666d	/* "myfm" */
+
+#define MYFS_MIG_START		1	/* struct myfs_mig_start */
+#define MYFS_MIG_INODE		2	/* myfs_mig_inode, then a symlink's target */
+#define MYFS_MIG_DIR		3	/* myfs_mig_dir, then myfs_mig_dirents */
+#define MYFS_MIG_DATA		4	/* myfs_mig_data, then one page */
+#define MYFS_MIG_END		5	/* no payload */
+
+struct myfs_mig_hdr {
+	__u32	type;
+	__u32	len;
+	__u64	ino;		/* 0 for START and END */
+};
+
+struct myfs_mig_start {
+	__u32	magic;
+	__u32	pass;
+	__u64	root_ino;
+	__u32	page_size;
+	__u32	__pad;
+};
+
+struct myfs_mig_inode {
+	__u32	mode;
+	__u32	nlink;
+	__u32	uid;
+	__u32	gid;
+	__u32	rdev;		/* new_encode_dev() */
+	__u32	__pad;
+	__u64	size;
+	__u64	trunc;		/* data from here on was dropped, or ~0 */
+	__s64	atime_sec;
+	__s64	mtime_sec;
+	__s64	ctime_sec;
+	__u32	atime_nsec;
+	__u32	mtime_nsec;
+	__u32	ctime_nsec;
+	__u32	__pad2;
+};
+
+#define MYFS_MIG_DIR_CONT	0x1	/* continues this directory's listing */
+
+struct myfs_mig_dir {
+	__u32	flags;
+	__u32	nr;		/* entries that follow */
+};
+
+struct myfs_mig_dirent {
+	__u64	ino;
+	__u16	name_len;
+	__u8	type;		/* DT_* */
+	__u8	__pad[5];
+	char	name[];		/* NUL terminated, padded to 8 */
+};
+
+struct myfs_mig_data {
+	__u64	index;		/* page index in the file */
+};
+
+/*
+ * Untorn writes, for database pages.  Once enabled on a file, a write()
+ * of at most @unit_max bytes is seen by read() and by loads through a
+ * mapping whole or not at all, wherever it lands; larger writes may be
+ * seen in part.  Stores through a mapping are not covered: they are not
+ * untorn themselves and can land in the middle of a write().  The
+ * argument of SET is 1 to enable, 0 to disable.
+ */
+struct myfs_untorn_info {
+	__u32	enabled;
+	__u32	unit_min;	/* bytes */
+	__u32	unit_max;
+	__u32	__reserved;
+};
+
+#define MYFS_IOC_SET_UNTORN	_IOW(MYFS_IOC_MAGIC, 14, __u32)
+#define MYFS_IOC_GET_UNTORN	_IOR(MYFS_IOC_MAGIC, 15, struct myfs_untorn_info)
+
+/*
+ * MYFS_IOC_XCHG_RANGE, on a regular file: exchange @length bytes at
+ * @offset1 of it with as many at @offset2 of the file open as @fd, by
+ * swapping pages.  Nothing is copied, and both files keep their inode,
+ * open descriptors, mappings and links.  Offsets and length must be
+ * page aligned, and each range must lie within the file's size rounded
+ * up to a page.  With MYFS_XCHG_FULL (offsets and length 0) the whole
+ * contents and the sizes are exchanged.  Both files must be open for
+ * reading and writing on the same mount.  Writes, truncation and faults
+ * see the exchange all at once; read() may see it page by page.
+ */
+#define MYFS_XCHG_FULL		0x1
+
+struct myfs_xchg_range {
+	__s32	fd;
+	__u32	flags;
+	__u64	offset1;
+	__u64	offset2;
+	__u64	length;
+};
+
+#define MYFS_IOC_XCHG_RANGE	_IOW(MYFS_IOC_MAGIC, 16, struct myfs_xchg_range)
+
+#endif /* _MYFS_H */
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM myfs
+
+#if !defined(_MYFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MYFS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Operation stream for tools/myfs-trace.  Every event carries the start
+ * time (ktime_get_ns) and latency of the operation; names are printed
+ * last, preceded by their length, so they can be parsed back exactly.
+ * The clock is only read while the event is enabled, so an operation
+ * that was already running when it was turned on reports ts=0 lat=0.
+ */
+TRACE_EVENT(myfs_rw,
+	TP_PROTO(const char *op, struct inode *inode, loff_t pos, size_t len,
+		 ssize_t ret, u64 start),
+
+	TP_ARGS(op, inode, pos, len, ret, start),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__string(op,		op)
+		__field(unsigned long,	ino)
+		__field(loff_t,		pos)
+		__field(size_t,		len)
+		__field(ssize_t,	ret)
+		__field(u64,		ts)
+		__field(u64,		lat)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__assign_str(op, op);
+		__entry->ino	= inode->i_ino;
+		__entry->pos	= pos;
+		__entry->len	= len;
+		__entry->ret	= ret;
+		__entry->ts	= start;
+		__entry->lat	= start ? ktime_get_ns() - start : 0;
+	),
+
+	TP_printk("dev=%d:%d op=%s ino=%lu pos=%lld len=%zu ret=%zd ts=%llu lat=%llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __get_str(op),
+		  __entry->ino, __entry->pos, __entry->len, __entry->ret,
+		  __entry->ts, __entry->lat)
+);
+
+/*
+ * Namespace operations.  @dentry is the name operated on in @dir; for
+ * rename @dir2/@dentry2 is the destination and @mode holds the rename
+ * flags, for link @ino is the inode being linked.
+ */
+TRACE_EVENT(myfs_namespace,
+	TP_PROTO(const char *op, struct inode *dir, struct dentry *dentry,
+		 struct inode *inode, struct inode *dir2,
+		 struct dentry *dentry2, unsigned int mode, int ret, u64 start),
+
+	TP_ARGS(op, dir, dentry, inode, dir2, dentry2, mode, ret, start),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__string(op,		op)
+		__field(unsigned long,	dir)
+		__field(unsigned long,	ino)
+		__field(unsigned long,	dir2)
+		__field(unsigned int,	mode)
+		__field(int,		ret)
+		__field(u64,		ts)
+		__field(u64,		lat)
+		__field(unsigned int,	nlen)
+		__field(unsigned int,	nlen2)
+		__string(name,		dentry->d_name.name)
+		__string(name2,		dentry2 ? (const char *)dentry2->d_name.name : "")
+	),
+
+	TP_fast_assign(
+		__entry->dev	= dir->i_sb->s_dev;
+		__assign_str(op, op);
+		__entry->dir	= dir->i_ino;
+		__entry->ino	= inode ? inode->i_ino : 0;
+		__entry->dir2	= dir2 ? dir2->i_ino : 0;
+		__entry->mode	= mode;
+		__entry->ret	= ret;
+		__entry->ts	= start;
+		__entry->lat	= start ? ktime_get_ns() - start : 0;
+		__entry->nlen	= dentry->d_name.len;
+		__entry->nlen2	= dentry2 ? dentry2->d_name.len : 0;
+		__assign_str(name, dentry->d_name.name);
+		__assign_str(name2, dentry2 ? (const char *)dentry2->d_name.name : "");
+	),
+
+	TP_printk("dev=%d:%d op=%s dir=%lu ino=%lu dir2=%lu mode=0%o ret=%d ts=%llu lat=%llu name=%u:%s name2=%u:%s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __get_str(op),
+		  __entry->dir, __entry->ino, __entry->dir2, __entry->mode,
+		  __entry->ret, __entry->ts, __entry->lat,
+		  __entry->nlen, __get_str(name), __entry->nlen2,
+		  __get_str(name2))
+);
+
+/*
+ * A file dropped to make room: @why is "lru" when a cache=lru mount
+ * unlinked it, "purge" when the shrinker dropped the contents of an
+ * unpinned purgeable file; @nr_pages what it held.
+ */
+TRACE_EVENT(myfs_evict,
+	TP_PROTO(const char *why, struct inode *inode, unsigned long nr_pages),
+
+	TP_ARGS(why, inode, nr_pages),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__string(why,		why)
+		__field(unsigned long,	ino)
+		__field(unsigned long,	nr_pages)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__assign_str(why, why);
+		__entry->ino	= inode->i_ino;
+		__entry->nr_pages = nr_pages;
+	),
+
+	TP_printk("dev=%d:%d why=%s ino=%lu pages=%lu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __get_str(why),
+		  __entry->ino, __entry->nr_pages)
+);
+
+#endif /* _MYFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE myfs_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-freeze-bench: how long writers stall across a freeze/thaw cycle
+ * under write load.  Needs CAP_SYS_ADMIN for FIFREEZE.
+ *
+ *   myfs-freeze-bench -d /mnt/myfs [-t 8] [-s 64K] [-f 64M] [-H 100]
+ *                     [-i 10] [-m]
+ *
+ * Each writer thread overwrites its own -f sized file in -s sized
+ * chunks, with pwrite() or, with -m, by storing through a shared
+ * mapping.  Every iteration the main thread freezes the mount, holds it
+ * frozen for -H milliseconds and thaws it.
+ *
+ * Reported per iteration: FIFREEZE and FITHAW latency, and the longest
+ * single write any thread saw around the cycle.  With the mount working
+ * as it should, that is about freeze + hold + thaw.  A stall much
+ * shorter than the hold means writes got through while frozen.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+static int nr_threads = 8;
+static size_t chunk = 64 << 10;
+static uint64_t file_size = 64 << 20;
+static int hold_ms = 100;
+static int iterations = 10;
+static int use_mmap;
+static int stop;
+
+struct writer {
+	pthread_t	thread;
+	int		fd;
+	char		*map;
+	uint64_t	max_ns;		/* longest write since the last reset */
+	uint64_t	ops;
+	int		reset;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-freeze-bench -d DIR [-t THREADS] [-s CHUNK] [-f FILE_SIZE]\n"
+		"                         [-H HOLD_MS] [-i ITERATIONS] [-m]\n");
+	exit(2);
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G': v <<= 10; /* fall through */
+	case 'm': case 'M': v <<= 10; /* fall through */
+	case 'k': case 'K': v <<= 10;
+	}
+	return v;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *run_writer(void *arg)
+{
+	struct writer *w = arg;
+	char *buf = malloc(chunk);
+	uint64_t off = 0, start, t;
+
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, chunk);
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		start = now_ns();
+		if (use_mmap)
+			memset(w->map + off, (char)w->ops, chunk);
+		else if (pwrite(w->fd, buf, chunk, off) != (ssize_t)chunk)
+			die("pwrite");
+		t = now_ns() - start;
+
+		if (__atomic_exchange_n(&w->reset, 0, __ATOMIC_ACQ_REL))
+			__atomic_store_n(&w->max_ns, 0, __ATOMIC_RELAXED);
+		if (t > __atomic_load_n(&w->max_ns, __ATOMIC_RELAXED))
+			__atomic_store_n(&w->max_ns, t, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&w->ops, 1, __ATOMIC_RELAXED);
+		off += chunk;
+		if (off + chunk > file_size)
+			off = 0;
+	}
+	free(buf);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = NULL;
+	struct writer *w;
+	char path[4096];
+	uint64_t t0, t1, t2, t3, stall, ops;
+	int dfd, c, i, it;
+
+	while ((c = getopt(argc, argv, "d:t:s:f:H:i:m")) != -1) {
+		switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			chunk = parse_size(optarg);
+			break;
+		case 'f':
+			file_size = parse_size(optarg);
+			break;
+		case 'H':
+			hold_ms = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'm':
+			use_mmap = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!dir || nr_threads < 1 || !chunk || file_size < chunk ||
+	    hold_ms < 0 || iterations < 1)
+		usage();
+
+	dfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		die(dir);
+	w = calloc(nr_threads, sizeof(*w));
+	if (!w)
+		die("calloc");
+	for (i = 0; i < nr_threads; i++) {
+		snprintf(path, sizeof(path), "%s/myfs-freeze-bench.XXXXXX", dir);
+		w[i].fd = mkstemp(path);
+		if (w[i].fd < 0)
+			die(path);
+		unlink(path);
+		if (ftruncate(w[i].fd, file_size))
+			die("ftruncate");
+		if (use_mmap) {
+			w[i].map = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
+					MAP_SHARED, w[i].fd, 0);
+			if (w[i].map == MAP_FAILED)
+				die("mmap");
+		}
+		if (pthread_create(&w[i].thread, NULL, run_writer, &w[i]))
+			die("pthread_create");
+	}
+
+	printf("%d %s writers, %zu KiB chunks, %" PRIu64 " MiB files, hold %d ms\n",
+	       nr_threads, use_mmap ? "mmap" : "pwrite", chunk >> 10,
+	       file_size >> 20, hold_ms);
+	printf("%4s %12s %12s %12s %14s\n", "iter", "freeze_ms", "thaw_ms",
+	       "stall_ms", "writes/s");
+	for (it = 0; it < iterations; it++) {
+		/* settle, so the window measured is just this cycle */
+		usleep(200 * 1000);
+		for (i = 0; i < nr_threads; i++)
+			__atomic_store_n(&w[i].reset, 1, __ATOMIC_RELEASE);
+		ops = 0;
+		for (i = 0; i < nr_threads; i++)
+			ops -= __atomic_load_n(&w[i].ops, __ATOMIC_RELAXED);
+
+		t0 = now_ns();
+		if (ioctl(dfd, FIFREEZE, 0))
+			die("FIFREEZE");
+		t1 = now_ns();
+		usleep(hold_ms * 1000);
+		t2 = now_ns();
+		if (ioctl(dfd, FITHAW, 0))
+			die("FITHAW");
+		t3 = now_ns();
+		usleep(200 * 1000);
+
+		stall = 0;
+		for (i = 0; i < nr_threads; i++) {
+			uint64_t m = __atomic_load_n(&w[i].max_ns, __ATOMIC_RELAXED);
+
+			if (m > stall)
+				stall = m;
+			ops += __atomic_load_n(&w[i].ops, __ATOMIC_RELAXED);
+		}
+		printf("%4d %12.3f %12.3f %12.3f %14.0f\n", it,
+		       (t1 - t0) / 1e6, (t3 - t2) / 1e6, stall / 1e6,
+		       ops / ((now_ns() - t0) / 1e9));
+	}
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		if (use_mmap)
+			munmap(w[i].map, file_size);
+		close(w[i].fd);
+	}
+	free(w);
+	close(dfd);
+	return 0;
+}
@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-hint-bench: memory fragmentation left behind by short-lived
+ * files written alongside long-lived ones, with and without
+ * write-lifetime hints.
+ *
+ *   myfs-hint-bench -d /mnt/myfs [-s 1G] [-f 4M] [-r 50] [-T 256M] [-n]
+ *
+ * Writes -s bytes of -f sized files, interleaving short-lived and
+ * long-lived files chunk by chunk; -r percent of them are short-lived.
+ * Then deletes the short-lived ones.  The files get RWH_WRITE_LIFE_SHORT
+ * and RWH_WRITE_LIFE_EXTREME through F_SET_RW_HINT, unless -n.
+ *
+ * After each phase it reports the free memory in order-9 and larger
+ * buddy blocks (/proc/buddyinfo), and the THP success rate: the share
+ * of a -T sized MADV_HUGEPAGE anonymous mapping that was backed by huge
+ * pages after it was touched.  Run it once with -n and once without to
+ * compare.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef F_SET_RW_HINT
+#define F_SET_RW_HINT		1036
+#endif
+#ifndef RWH_WRITE_LIFE_SHORT
+#define RWH_WRITE_LIFE_SHORT	2
+#define RWH_WRITE_LIFE_EXTREME	5
+#endif
+
+#define CHUNK		(1 << 20)
+#define HUGE_ORDER	9
+
+static uint64_t total_size = 1ULL << 30;
+static uint64_t file_size = 4 << 20;
+static uint64_t thp_size = 256 << 20;
+static int short_pct = 50;
+static int no_hints;
+static long page_size;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-hint-bench -d DIR [-s TOTAL] [-f FILE_SIZE] [-r SHORT_PCT]\n"
+		"                       [-T THP_TEST_SIZE] [-n]\n");
+	exit(2);
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G': v <<= 10; /* fall through */
+	case 'm': case 'M': v <<= 10; /* fall through */
+	case 'k': case 'K': v <<= 10;
+	}
+	return v;
+}
+
+/* Free bytes in blocks of order HUGE_ORDER or more, over all zones. */
+static uint64_t free_huge_blocks(void)
+{
+	char line[512], *p;
+	uint64_t bytes = 0, n;
+	int order;
+	FILE *f = fopen("/proc/buddyinfo", "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		/* "Node 0, zone   Normal   12 34 ..." */
+		p = strstr(line, "zone");
+		if (!p)
+			continue;
+		p += 4;
+		while (*p == ' ')
+			p++;
+		while (*p && *p != ' ')
+			p++;
+		for (order = 0; ; order++) {
+			char *end;
+
+			n = strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			if (order >= HUGE_ORDER)
+				bytes += n * ((uint64_t)page_size << order);
+			p = end;
+		}
+	}
+	fclose(f);
+	return bytes;
+}
+
+/* A "Key:   123 kB" value from a /proc file. */
+static uint64_t read_kb(const char *file, const char *key)
+{
+	char line[256];
+	uint64_t v = 0;
+	FILE *f = fopen(file, "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, key, strlen(key))) {
+			v = strtoull(line + strlen(key), NULL, 10);
+			break;
+		}
+	fclose(f);
+	return v;
+}
+
+/* Percentage of a fresh MADV_HUGEPAGE mapping backed by huge pages. */
+static double thp_success(void)
+{
+	uint64_t before, after, off;
+	char *p;
+
+	before = read_kb("/proc/self/smaps_rollup", "AnonHugePages:");
+	p = mmap(NULL, thp_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		die("mmap");
+	madvise(p, thp_size, MADV_HUGEPAGE);
+	for (off = 0; off < thp_size; off += page_size)
+		p[off] = 1;
+	after = read_kb("/proc/self/smaps_rollup", "AnonHugePages:");
+	munmap(p, thp_size);
+	return (after - before) * 1024 * 100.0 / thp_size;
+}
+
+static void report(const char *phase)
+{
+	printf("%-16s %14" PRIu64 " %10.1f\n", phase,
+	       free_huge_blocks() >> 20, thp_success());
+}
+
+static void set_hint(int fd, uint64_t hint)
+{
+	if (!no_hints && fcntl(fd, F_SET_RW_HINT, &hint))
+		die("F_SET_RW_HINT");
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = NULL;
+	char path[4096], *buf;
+	uint64_t nr_files, i, off;
+	int *fds, *is_short, c;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	while ((c = getopt(argc, argv, "d:s:f:r:T:n")) != -1) {
+		switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 's':
+			total_size = parse_size(optarg);
+			break;
+		case 'f':
+			file_size = parse_size(optarg);
+			break;
+		case 'r':
+			short_pct = atoi(optarg);
+			break;
+		case 'T':
+			thp_size = parse_size(optarg);
+			break;
+		case 'n':
+			no_hints = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!dir || file_size < CHUNK || total_size < file_size ||
+	    short_pct < 0 || short_pct > 100 || !thp_size)
+		usage();
+
+	nr_files = total_size / file_size;
+	fds = calloc(nr_files, sizeof(*fds));
+	is_short = calloc(nr_files, sizeof(*is_short));
+	buf = malloc(CHUNK);
+	if (!fds || !is_short || !buf)
+		die("malloc");
+	memset(buf, 0x5a, CHUNK);
+
+	printf("%" PRIu64 " files of %" PRIu64 " MiB, %d%% short-lived, %s\n",
+	       nr_files, file_size >> 20, short_pct,
+	       no_hints ? "no hints" : "with hints");
+	printf("%-16s %14s %10s\n", "phase", "free_o9_MiB", "thp_%");
+	report("start");
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/myfs-hint-bench.XXXXXX", dir);
+		fds[i] = mkstemp(path);
+		if (fds[i] < 0)
+			die(path);
+		unlink(path);
+		/* spread the short-lived files evenly */
+		is_short[i] = (i + 1) * short_pct / 100 != i * short_pct / 100;
+		set_hint(fds[i], is_short[i] ? RWH_WRITE_LIFE_SHORT :
+					      RWH_WRITE_LIFE_EXTREME);
+	}
+	/* chunk by chunk across all files, so their pages interleave */
+	for (off = 0; off < file_size; off += CHUNK)
+		for (i = 0; i < nr_files; i++)
+			if (pwrite(fds[i], buf, CHUNK, off) != CHUNK)
+				die("pwrite");
+	report("written");
+
+	for (i = 0; i < nr_files; i++)
+		if (is_short[i]) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	report("short removed");
+
+	for (i = 0; i < nr_files; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	report("all removed");
+	free(fds);
+	free(is_short);
+	free(buf);
+	return 0;
+}
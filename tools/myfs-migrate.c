@@ -0,0 +1,465 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-migrate: copy a live myfs mount to another place with iterative
+ * pre-copy (MYFS_IOC_MIGRATE_SEND).
+ *
+ *   myfs-migrate send [-n MAX_DELTAS] [-p PAGES] [-u] /mnt/myfs > stream
+ *   myfs-migrate recv DIR < stream
+ *
+ * send writes a FULL pass to stdout, then DELTA passes until one sends
+ * no more than PAGES pages (or MAX_DELTAS of them have been sent), then
+ * the FINAL pass, which freezes the mount.  Pipe it into recv, locally
+ * or through ssh/nc, to rebuild the tree under DIR (typically an empty
+ * myfs mount).  The source is left frozen, so nothing changes before
+ * clients have moved to the copy; thaw it then with fsfreeze -u, or
+ * pass -u to thaw it as soon as the stream is out.
+ *
+ * recv keeps file data in a staging directory, DIR/.myfs-migrate, and
+ * the namespace in memory, because later passes may rename or remove
+ * anything.  After the FINAL pass it builds the tree from the root
+ * listing, hard-linking staged files into place, and sets owners, modes
+ * and times.  Extended attributes, seals and TTLs are not carried over.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include "../myfs.h"
+
+#define STAGING		".myfs-migrate"
+#define HASH_BITS	16
+
+static const char *pass_names[] = { "full", "delta", "final" };
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-migrate send [-n MAX_DELTAS] [-p PAGES] [-u] MOUNT > STREAM\n"
+		"       myfs-migrate recv DIR < STREAM\n");
+	exit(2);
+}
+
+/* ------------------------------------------------------------------ send */
+
+static void send_pass(int dirfd, unsigned int pass, struct myfs_migrate *m)
+{
+	memset(m, 0, sizeof(*m));
+	m->fd = STDOUT_FILENO;
+	m->pass = pass;
+	if (ioctl(dirfd, MYFS_IOC_MIGRATE_SEND, m))
+		die("MYFS_IOC_MIGRATE_SEND");
+	fprintf(stderr, "%-5s %10" PRIu64 " inodes %10" PRIu64 " dirs %10" PRIu64
+		" pages %12" PRIu64 " bytes\n", pass_names[pass],
+		(uint64_t)m->inodes, (uint64_t)m->dirs, (uint64_t)m->pages,
+		(uint64_t)m->bytes);
+}
+
+static int cmd_send(int argc, char **argv)
+{
+	unsigned long max_deltas = 8, min_pages = 256, i;
+	struct myfs_migrate m;
+	int c, dirfd, thaw = 0;
+
+	while ((c = getopt(argc, argv, "n:p:u")) != -1) {
+		switch (c) {
+		case 'n': max_deltas = strtoul(optarg, NULL, 0); break;
+		case 'p': min_pages = strtoul(optarg, NULL, 0); break;
+		case 'u': thaw = 1; break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+	dirfd = open(argv[optind], O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0)
+		die(argv[optind]);
+
+	send_pass(dirfd, MYFS_MIGRATE_FULL, &m);
+	for (i = 0; i < max_deltas && m.pages > min_pages; i++)
+		send_pass(dirfd, MYFS_MIGRATE_DELTA, &m);
+	send_pass(dirfd, MYFS_MIGRATE_FINAL, &m);
+	if (thaw) {
+		if (ioctl(dirfd, FITHAW, 0))
+			die("FITHAW");
+	} else {
+		fprintf(stderr, "%s left frozen; thaw with fsfreeze -u\n",
+			argv[optind]);
+	}
+	close(dirfd);
+	return 0;
+}
+
+/* ------------------------------------------------------------------ recv */
+
+struct dent {
+	uint64_t	ino;
+	char		*name;
+};
+
+struct obj {
+	uint64_t	ino;
+	struct myfs_mig_inode attr;
+	int		have_attr;
+	int		staged;		/* has a file in the staging dir */
+	char		*target;	/* symlinks */
+	struct dent	*ents;		/* directories */
+	size_t		nr_ents, max_ents;
+	struct obj	*next;
+};
+
+static struct obj *objs[1 << HASH_BITS];
+static int staging_fd = -1;
+static int cur_fd = -1;
+static uint64_t cur_ino;
+static uint32_t page_size;
+
+static struct obj *get_obj(uint64_t ino)
+{
+	struct obj **slot = &objs[(ino * 0x9e3779b97f4a7c15ULL) >> (64 - HASH_BITS)];
+	struct obj *o;
+
+	for (o = *slot; o; o = o->next)
+		if (o->ino == ino)
+			return o;
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		die("calloc");
+	o->ino = ino;
+	o->next = *slot;
+	*slot = o;
+	return o;
+}
+
+static struct obj *find_obj(uint64_t ino)
+{
+	struct obj *o = objs[(ino * 0x9e3779b97f4a7c15ULL) >> (64 - HASH_BITS)];
+
+	while (o && o->ino != ino)
+		o = o->next;
+	return o;
+}
+
+/* The staging file of @o, open for writing; records come grouped by inode. */
+static int stage_fd(struct obj *o)
+{
+	char name[32];
+
+	if (cur_fd >= 0 && cur_ino == o->ino)
+		return cur_fd;
+	if (cur_fd >= 0)
+		close(cur_fd);
+	snprintf(name, sizeof(name), "%" PRIu64, o->ino);
+	cur_fd = openat(staging_fd, name, O_WRONLY | O_CREAT, 0600);
+	if (cur_fd < 0)
+		die(name);
+	cur_ino = o->ino;
+	o->staged = 1;
+	return cur_fd;
+}
+
+static void free_ents(struct obj *o)
+{
+	size_t i;
+
+	for (i = 0; i < o->nr_ents; i++)
+		free(o->ents[i].name);
+	o->nr_ents = 0;
+}
+
+static void read_full(void *buf, size_t len, int eof_ok, int *eof)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(STDIN_FILENO, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			die("read");
+		if (!n) {
+			if (eof_ok && p == buf) {
+				*eof = 1;
+				return;
+			}
+			fprintf(stderr, "myfs-migrate: truncated stream\n");
+			exit(1);
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+static void bad_record(const struct myfs_mig_hdr *h)
+{
+	fprintf(stderr, "myfs-migrate: bad record type %u len %u ino %" PRIu64 "\n",
+		h->type, h->len, (uint64_t)h->ino);
+	exit(1);
+}
+
+static void recv_inode(const struct myfs_mig_hdr *h, const char *p)
+{
+	struct obj *o = get_obj(h->ino);
+	const struct myfs_mig_inode *a = (const void *)p;
+	int fd;
+
+	if (h->len < sizeof(*a))
+		bad_record(h);
+	o->attr = *a;
+	o->have_attr = 1;
+	if (S_ISLNK(a->mode)) {
+		free(o->target);
+		o->target = strndup(p + sizeof(*a), h->len - sizeof(*a));
+	} else if (S_ISREG(a->mode)) {
+		fd = stage_fd(o);
+		if (a->trunc != (__u64)~0ULL && ftruncate(fd, a->trunc))
+			die("ftruncate");
+		if (ftruncate(fd, a->size))
+			die("ftruncate");
+	}
+}
+
+static void recv_dir(const struct myfs_mig_hdr *h, const char *p)
+{
+	struct obj *o = get_obj(h->ino);
+	const struct myfs_mig_dir *d = (const void *)p;
+	const char *end = p + h->len;
+	uint32_t i;
+
+	if (h->len < sizeof(*d))
+		bad_record(h);
+	if (!(d->flags & MYFS_MIG_DIR_CONT))
+		free_ents(o);
+	p += sizeof(*d);
+	for (i = 0; i < d->nr; i++) {
+		const struct myfs_mig_dirent *e = (const void *)p;
+		size_t elen;
+
+		if (end - p < (ssize_t)sizeof(*e))
+			bad_record(h);
+		elen = (sizeof(*e) + e->name_len + 1 + 7) & ~7UL;
+		if (end - p < (ssize_t)elen)
+			bad_record(h);
+		if (o->nr_ents == o->max_ents) {
+			o->max_ents = o->max_ents ? o->max_ents * 2 : 16;
+			o->ents = realloc(o->ents, o->max_ents * sizeof(*o->ents));
+			if (!o->ents)
+				die("realloc");
+		}
+		o->ents[o->nr_ents].ino = e->ino;
+		o->ents[o->nr_ents].name = strndup(e->name, e->name_len);
+		o->nr_ents++;
+		p += elen;
+	}
+}
+
+static void recv_data(const struct myfs_mig_hdr *h, const char *p)
+{
+	const struct myfs_mig_data *d = (const void *)p;
+	int fd;
+
+	if (h->len != sizeof(*d) + page_size)
+		bad_record(h);
+	fd = stage_fd(get_obj(h->ino));
+	if (pwrite(fd, p + sizeof(*d), page_size,
+		   (off_t)d->index * page_size) != (ssize_t)page_size)
+		die("pwrite");
+}
+
+static void set_attr(int dirfd, const char *name, const struct obj *o)
+{
+	const struct myfs_mig_inode *a = &o->attr;
+	struct timespec ts[2] = {
+		{ .tv_sec = a->atime_sec, .tv_nsec = a->atime_nsec },
+		{ .tv_sec = a->mtime_sec, .tv_nsec = a->mtime_nsec },
+	};
+	static int warned;
+
+	if (fchownat(dirfd, name, a->uid, a->gid, AT_SYMLINK_NOFOLLOW) &&
+	    !warned++)
+		perror("chown (owners not kept)");
+	if (!S_ISLNK(a->mode) && fchmodat(dirfd, name, a->mode & 07777, 0))
+		perror(name);
+	if (utimensat(dirfd, name, ts, AT_SYMLINK_NOFOLLOW))
+		perror(name);
+}
+
+static void build(const struct obj *dir, int dirfd)
+{
+	char stage_name[32];
+	size_t i;
+	int fd;
+
+	for (i = 0; i < dir->nr_ents; i++) {
+		const char *name = dir->ents[i].name;
+		struct obj *o = find_obj(dir->ents[i].ino);
+		uint32_t mode, dev;
+
+		if (!o || !o->have_attr) {
+			fprintf(stderr, "myfs-migrate: no inode %" PRIu64 " for %s\n",
+				dir->ents[i].ino, name);
+			continue;
+		}
+		mode = o->attr.mode;
+		switch (mode & S_IFMT) {
+		case S_IFDIR:
+			if (mkdirat(dirfd, name, 0700))
+				die(name);
+			fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY);
+			if (fd < 0)
+				die(name);
+			build(o, fd);
+			close(fd);
+			break;
+		case S_IFREG:
+			fd = stage_fd(o);
+			if (ftruncate(fd, o->attr.size))
+				die("ftruncate");
+			snprintf(stage_name, sizeof(stage_name), "%" PRIu64, o->ino);
+			if (linkat(staging_fd, stage_name, dirfd, name, 0))
+				die(name);
+			break;
+		case S_IFLNK:
+			if (symlinkat(o->target ? o->target : "", dirfd, name))
+				die(name);
+			break;
+		default:
+			dev = o->attr.rdev;
+			if (mknodat(dirfd, name, mode,
+				    makedev((dev & 0xfff00) >> 8,
+					    (dev & 0xff) | ((dev >> 12) & 0xfff00))))
+				die(name);
+			break;
+		}
+		/* directories last, after their entries changed their times */
+		set_attr(dirfd, name, o);
+	}
+}
+
+static void materialize(int top, uint64_t root_ino)
+{
+	struct obj *root = find_obj(root_ino), *o;
+	char name[32];
+	size_t i;
+
+	if (!root || !root->have_attr) {
+		fprintf(stderr, "myfs-migrate: stream has no root directory\n");
+		exit(1);
+	}
+	build(root, top);
+
+	if (cur_fd >= 0)
+		close(cur_fd);
+	for (i = 0; i < sizeof(objs) / sizeof(objs[0]); i++) {
+		for (o = objs[i]; o; o = o->next) {
+			if (!o->staged)
+				continue;
+			snprintf(name, sizeof(name), "%" PRIu64, o->ino);
+			if (unlinkat(staging_fd, name, 0))
+				die(name);
+		}
+	}
+	close(staging_fd);
+	if (unlinkat(top, STAGING, AT_REMOVEDIR))
+		die(STAGING);
+	set_attr(top, ".", root);
+}
+
+static int cmd_recv(int argc, char **argv)
+{
+	struct myfs_mig_start start = { 0 };
+	struct myfs_mig_hdr h;
+	size_t cap = 0, plen;
+	char *payload = NULL;
+	int top, eof = 0;
+
+	if (argc != 2)
+		usage();
+	top = open(argv[1], O_RDONLY | O_DIRECTORY);
+	if (top < 0)
+		die(argv[1]);
+	if (mkdirat(top, STAGING, 0700))
+		die(STAGING);
+	staging_fd = openat(top, STAGING, O_RDONLY | O_DIRECTORY);
+	if (staging_fd < 0)
+		die(STAGING);
+
+	for (;;) {
+		read_full(&h, sizeof(h), 1, &eof);
+		if (eof) {
+			fprintf(stderr, "myfs-migrate: stream ended before the final pass\n");
+			return 1;
+		}
+		plen = ((size_t)h.len + 7) & ~7UL;
+		if (plen > cap) {
+			cap = plen;
+			payload = realloc(payload, cap);
+			if (!payload)
+				die("realloc");
+		}
+		read_full(payload, plen, 0, &eof);
+
+		switch (h.type) {
+		case MYFS_MIG_START:
+			if (h.len < sizeof(start))
+				bad_record(&h);
+			memcpy(&start, payload, sizeof(start));
+			if (start.magic != MYFS_MIG_MAGIC || start.pass > MYFS_MIGRATE_FINAL) {
+				fprintf(stderr, "myfs-migrate: not a myfs migration stream\n");
+				return 1;
+			}
+			page_size = start.page_size;
+			break;
+		case MYFS_MIG_INODE:
+			recv_inode(&h, payload);
+			break;
+		case MYFS_MIG_DIR:
+			recv_dir(&h, payload);
+			break;
+		case MYFS_MIG_DATA:
+			recv_data(&h, payload);
+			break;
+		case MYFS_MIG_END:
+			fprintf(stderr, "received %s pass\n", pass_names[start.pass]);
+			if (start.pass == MYFS_MIGRATE_FINAL) {
+				materialize(top, start.root_ino);
+				free(payload);
+				close(top);
+				return 0;
+			}
+			break;
+		default:
+			bad_record(&h);
+		}
+		if (!page_size)
+			bad_record(&h);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		usage();
+	if (!strcmp(argv[1], "send"))
+		return cmd_send(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "recv"))
+		return cmd_recv(argc - 1, argv + 1);
+	usage();
+	return 2;
+}
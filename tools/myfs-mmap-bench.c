@@ -0,0 +1,400 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-mmap-bench: fault scalability of file mappings on myfs, compared
+ * with any other directories given (typically a tmpfs mount).
+ *
+ *   myfs-mmap-bench -d /mnt/myfs -d /dev/shm [-s 4G] [-t 8 | -P 8]
+ *                   [-m seq|rand|write|populate] [-p shared|private] [-W | -F]
+ *
+ * Every worker (thread or process) faults in its own slice of one file:
+ * seq touches each page in order, rand visits the slice's pages in a
+ * pseudo-random order, write stores to each page, populate maps the
+ * slice with MAP_POPULATE.  -W fills the file with pwrite() first so
+ * only the mapping cost is measured, not page allocation; -F does the
+ * same with fallocate(), which myfs spreads over all CPUs.
+ *
+ * Reported per directory: elapsed time, page faults and faults/sec, dTLB
+ * misses (perf, inherited by all workers) and page-table memory of the
+ * populated mappings.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define MAX_DIRS	8
+
+enum mode { MODE_SEQ, MODE_RAND, MODE_WRITE, MODE_POPULATE };
+
+static const char *mode_names[] = { "seq", "rand", "write", "populate" };
+
+static int workers = 1;
+static int use_procs;
+static int prefill;		/* 'W' or 'F' */
+static int shared = 1;
+static enum mode mode = MODE_SEQ;
+static uint64_t file_size = 1ULL << 30;
+static long page_size;
+
+struct worker {
+	pthread_t	thread;
+	int		fd;
+	char		*map;		/* whole-file mapping for threads */
+	char		*slice_map;	/* populate: this thread's mapping */
+	uint64_t	off, len;
+	uint64_t	pte_kb;		/* filled in by processes */
+	volatile uint64_t sink;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-mmap-bench -d DIR [-d DIR...] [-s SIZE] [-t THREADS | -P PROCS]\n"
+		"                       [-m seq|rand|write|populate] [-p shared|private] [-W | -F]\n");
+	exit(2);
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G': v <<= 10; /* fall through */
+	case 'm': case 'M': v <<= 10; /* fall through */
+	case 'k': case 'K': v <<= 10;
+	}
+	return v;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int perf_open(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr = {
+		.size		= sizeof(attr),
+		.type		= type,
+		.config		= config,
+		.inherit	= 1,
+		.disabled	= 1,
+		.exclude_hv	= 1,
+	};
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t perf_read(int fd)
+{
+	uint64_t v = 0;
+
+	if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v))
+		return 0;
+	return v;
+}
+
+/* A "Key:   123 kB" value from a /proc file. */
+static uint64_t read_kb(const char *file, const char *key)
+{
+	char line[256];
+	uint64_t v = 0;
+	FILE *f = fopen(file, "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, key, strlen(key))) {
+			v = strtoull(line + strlen(key), NULL, 10);
+			break;
+		}
+	fclose(f);
+	return v;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static void touch(struct worker *w, char *base)
+{
+	uint64_t pages = w->len / page_size, i, idx, step;
+	uint64_t sum = 0;
+
+	if (!pages)
+		return;
+	/* a stride coprime to the page count visits every page once */
+	step = pages > 1 ? (pages * 618034 / 1000000) | 1 : 1;
+	while (gcd(step, pages) != 1)
+		step += 2;
+
+	for (i = 0; i < pages; i++) {
+		idx = mode == MODE_RAND ? (i * step) % pages : i;
+		if (mode == MODE_WRITE)
+			base[idx * page_size] = (char)i;
+		else
+			sum += base[idx * page_size];
+	}
+	w->sink = sum;
+}
+
+static char *map_slice(struct worker *w, int populate)
+{
+	int prot = PROT_READ | (mode == MODE_WRITE ? PROT_WRITE : 0);
+	int flags = (shared ? MAP_SHARED : MAP_PRIVATE) | (populate ? MAP_POPULATE : 0);
+	char *p;
+
+	if (mode == MODE_POPULATE && !shared)
+		prot |= PROT_WRITE;
+	p = mmap(NULL, w->len, prot, flags, w->fd, w->off);
+	if (p == MAP_FAILED)
+		die("mmap");
+	return p;
+}
+
+static void *run_thread(void *arg)
+{
+	struct worker *w = arg;
+
+	if (mode == MODE_POPULATE)
+		w->slice_map = map_slice(w, 1);
+	else
+		touch(w, w->map + w->off);
+	return NULL;
+}
+
+static void run_proc(struct worker *w)
+{
+	char *p = map_slice(w, mode == MODE_POPULATE);
+
+	if (mode != MODE_POPULATE)
+		touch(w, p);
+	w->pte_kb = read_kb("/proc/self/status", "VmPTE:");
+	_exit(0);
+}
+
+static void prefill_file(int fd)
+{
+	size_t chunk = 1 << 20;
+	char *buf = malloc(chunk);
+	uint64_t off;
+
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, chunk);
+	for (off = 0; off < file_size; off += chunk) {
+		size_t n = file_size - off < chunk ? file_size - off : chunk;
+
+		if (pwrite(fd, buf, n, off) != (ssize_t)n)
+			die("pwrite");
+	}
+	free(buf);
+}
+
+struct result {
+	double		prefill_secs;
+	double		secs;
+	uint64_t	faults;
+	uint64_t	dtlb;
+	uint64_t	pte_kb;
+};
+
+static struct result bench_dir(const char *dir)
+{
+	struct result res = { 0 };
+	struct worker *w;
+	char path[4096];
+	uint64_t slice, pte_before = 0;
+	int fd, pf, tlb, i;
+	double start;
+
+	snprintf(path, sizeof(path), "%s/myfs-mmap-bench.XXXXXX", dir);
+	fd = mkstemp(path);
+	if (fd < 0)
+		die(path);
+	unlink(path);
+	if (ftruncate(fd, file_size))
+		die("ftruncate");
+	start = now();
+	if (prefill == 'W')
+		prefill_file(fd);
+	else if (prefill == 'F' && fallocate(fd, 0, 0, file_size))
+		die("fallocate");
+	res.prefill_secs = now() - start;
+
+	/* shared with forked workers so they can report page-table usage */
+	w = mmap(NULL, workers * sizeof(*w), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (w == MAP_FAILED)
+		die("mmap");
+
+	slice = file_size / workers / page_size * page_size;
+	for (i = 0; i < workers; i++) {
+		w[i].fd = fd;
+		w[i].off = i * slice;
+		w[i].len = i == workers - 1 ? file_size - w[i].off : slice;
+	}
+	if (!use_procs && mode != MODE_POPULATE) {
+		struct worker whole = { .fd = fd, .off = 0, .len = file_size };
+		char *map = map_slice(&whole, 0);
+
+		for (i = 0; i < workers; i++)
+			w[i].map = map;
+	}
+
+	pf = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+	tlb = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	if (!use_procs)
+		pte_before = read_kb("/proc/self/status", "VmPTE:");
+
+	ioctl(pf, PERF_EVENT_IOC_ENABLE, 0);
+	if (tlb >= 0)
+		ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0);
+	start = now();
+
+	for (i = 0; i < workers; i++) {
+		if (use_procs) {
+			pid_t pid = fork();
+
+			if (pid < 0)
+				die("fork");
+			if (!pid)
+				run_proc(&w[i]);
+		} else if (pthread_create(&w[i].thread, NULL, run_thread, &w[i])) {
+			die("pthread_create");
+		}
+	}
+	for (i = 0; i < workers; i++) {
+		if (use_procs)
+			wait(NULL);
+		else
+			pthread_join(w[i].thread, NULL);
+	}
+
+	res.secs = now() - start;
+	ioctl(pf, PERF_EVENT_IOC_DISABLE, 0);
+	res.faults = perf_read(pf);
+	res.dtlb = perf_read(tlb);
+	close(pf);
+	if (tlb >= 0)
+		close(tlb);
+
+	if (use_procs) {
+		for (i = 0; i < workers; i++)
+			res.pte_kb += w[i].pte_kb;
+	} else {
+		res.pte_kb = read_kb("/proc/self/status", "VmPTE:") - pte_before;
+		for (i = 0; i < workers; i++)
+			if (w[i].slice_map)
+				munmap(w[i].slice_map, w[i].len);
+		if (w[0].map)
+			munmap(w[0].map, file_size);
+	}
+	munmap(w, workers * sizeof(*w));
+	close(fd);
+	return res;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dirs[MAX_DIRS];
+	struct result res[MAX_DIRS];
+	int nr_dirs = 0, c, i;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	while ((c = getopt(argc, argv, "d:s:t:P:m:p:WF")) != -1) {
+		switch (c) {
+		case 'd':
+			if (nr_dirs == MAX_DIRS)
+				usage();
+			dirs[nr_dirs++] = optarg;
+			break;
+		case 's':
+			file_size = parse_size(optarg);
+			break;
+		case 't':
+			workers = atoi(optarg);
+			use_procs = 0;
+			break;
+		case 'P':
+			workers = atoi(optarg);
+			use_procs = 1;
+			break;
+		case 'm':
+			for (i = 0; i < 4; i++)
+				if (!strcmp(optarg, mode_names[i]))
+					break;
+			if (i == 4)
+				usage();
+			mode = i;
+			break;
+		case 'p':
+			if (!strcmp(optarg, "shared"))
+				shared = 1;
+			else if (!strcmp(optarg, "private"))
+				shared = 0;
+			else
+				usage();
+			break;
+		case 'W':
+		case 'F':
+			prefill = c;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!nr_dirs || workers < 1 || file_size < (uint64_t)page_size * workers)
+		usage();
+
+	printf("mode %s, %s mapping, %d %s, file %" PRIu64 " MiB%s\n",
+	       mode_names[mode], shared ? "shared" : "private", workers,
+	       use_procs ? "processes" : "threads", file_size >> 20,
+	       prefill == 'W' ? ", prefilled with pwrite" :
+	       prefill == 'F' ? ", prefilled with fallocate" : "");
+	printf("%-24s %10s %10s %14s %14s %14s %12s %10s\n", "dir", "prefill",
+	       "secs", "faults", "faults/s", "dtlb_misses", "pte_kB", "vs_first");
+	for (i = 0; i < nr_dirs; i++) {
+		double rate;
+
+		res[i] = bench_dir(dirs[i]);
+		rate = res[i].faults / res[i].secs;
+		printf("%-24s %10.3f %10.3f %14" PRIu64 " %14.0f %14" PRIu64 " %12" PRIu64 " %9.2fx\n",
+		       dirs[i], res[i].prefill_secs, res[i].secs, res[i].faults,
+		       rate, res[i].dtlb,
+		       res[i].pte_kb,
+		       i ? rate / (res[0].faults / res[0].secs) : 1.0);
+	}
+	return 0;
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-negdent-bench: readdir and rmdir cost under temp file churn, to
+ * check that the negative dentries unlink leaves behind don't pile up.
+ *
+ *   myfs-negdent-bench -d /mnt/myfs [-d /mnt/tmpfs...] [-f 256] [-r 10]
+ *                      [-u 100000] [-m 10000]
+ *
+ * Fills a directory with -f files, then runs -r rounds.  Each round
+ * creates and unlinks -u unique names in it, looks up -m names that were
+ * never created, and times a full readdir.  A subdirectory churned the
+ * same way is then emptied and removed, timing the rmdir.
+ *
+ * Reported per directory and round: the readdir time, which should stay
+ * flat from the first round to the last.  A growing readdir means the
+ * unlinked names are still hanging off the directory.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_DIRS	8
+
+static int nr_files = 256;
+static int rounds = 10;
+static int nr_churn = 100000;
+static int nr_miss = 10000;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-negdent-bench -d DIR [-d DIR...] [-f FILES] [-r ROUNDS]\n"
+		"                          [-u CHURN] [-m MISSES]\n");
+	exit(2);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Create and unlink @n names no one has used before in @fd. */
+static void churn(int fd, int n)
+{
+	static unsigned long seq;
+	char name[32];
+	int i, f;
+
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "t%lu", seq++);
+		f = openat(fd, name, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (f < 0)
+			die(name);
+		close(f);
+		if (unlinkat(fd, name, 0))
+			die(name);
+	}
+}
+
+/* Look up @n names that don't exist; these negatives should stay. */
+static void miss(int fd, int n)
+{
+	struct stat st;
+	char name[32];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "m%d", i);
+		if (!fstatat(fd, name, &st, 0) || errno != ENOENT)
+			die(name);
+	}
+}
+
+static void fill(int fd, int n)
+{
+	char name[32];
+	int i, f;
+
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		f = openat(fd, name, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (f < 0)
+			die(name);
+		close(f);
+	}
+}
+
+static void empty(int fd, int n)
+{
+	char name[32];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		unlinkat(fd, name, 0);
+	}
+}
+
+static double time_readdir(int fd, int expect)
+{
+	struct dirent *de;
+	double start;
+	int entries = 0;
+	DIR *d;
+
+	fd = dup(fd);
+	if (fd < 0)
+		die("dup");
+	d = fdopendir(fd);
+	if (!d)
+		die("fdopendir");
+	/* the dup shares the last round's offset */
+	rewinddir(d);
+	start = now();
+	while ((de = readdir(d)))
+		if (de->d_name[0] != '.')
+			entries++;
+	start = now() - start;
+	closedir(d);
+	if (entries != expect) {
+		fprintf(stderr, "readdir saw %d entries, expected %d\n",
+			entries, expect);
+		exit(1);
+	}
+	return start;
+}
+
+static void bench_dir(const char *dir)
+{
+	char path[4096];
+	double first = 0, t;
+	int top, sub, i;
+
+	snprintf(path, sizeof(path), "%s/myfs-negdent-bench.XXXXXX", dir);
+	if (!mkdtemp(path))
+		die(path);
+	top = open(path, O_RDONLY | O_DIRECTORY);
+	if (top < 0)
+		die(path);
+	fill(top, nr_files);
+
+	printf("%s\n%6s %12s %12s %10s\n", dir, "round", "churned",
+	       "readdir", "vs_first");
+	for (i = 0; i < rounds; i++) {
+		churn(top, nr_churn);
+		miss(top, nr_miss);
+		t = time_readdir(top, nr_files);
+		if (!i)
+			first = t;
+		printf("%6d %12lld %12.6f %9.2fx\n", i,
+		       (long long)nr_churn * (i + 1), t, t / first);
+	}
+
+	if (mkdirat(top, "sub", 0755))
+		die("sub");
+	sub = openat(top, "sub", O_RDONLY | O_DIRECTORY);
+	if (sub < 0)
+		die("sub");
+	fill(sub, nr_files);
+	churn(sub, nr_churn * rounds);
+	empty(sub, nr_files);
+	close(sub);
+	t = now();
+	if (unlinkat(top, "sub", AT_REMOVEDIR))
+		die("rmdir sub");
+	printf("rmdir after %lld churned names: %.6f\n\n",
+	       (long long)nr_churn * rounds, now() - t);
+
+	empty(top, nr_files);
+	close(top);
+	rmdir(path);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dirs[MAX_DIRS];
+	int nr_dirs = 0, c, i;
+
+	while ((c = getopt(argc, argv, "d:f:r:u:m:")) != -1) {
+		switch (c) {
+		case 'd':
+			if (nr_dirs == MAX_DIRS)
+				usage();
+			dirs[nr_dirs++] = optarg;
+			break;
+		case 'f':
+			nr_files = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'u':
+			nr_churn = atoi(optarg);
+			break;
+		case 'm':
+			nr_miss = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!nr_dirs || nr_files < 0 || rounds < 1 || nr_churn < 0 || nr_miss < 0)
+		usage();
+
+	printf("%d files, %d rounds of %d created+unlinked and %d missed names\n\n",
+	       nr_files, rounds, nr_churn, nr_miss);
+	for (i = 0; i < nr_dirs; i++)
+		bench_dir(dirs[i]);
+	return 0;
+}
@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-scan-bench: readdir+stat throughput over a tree whose directories
+ * were filled at the same time, compared across the directories given
+ * (typically a myfs mount, a myfs mount with cluster, and tmpfs).
+ *
+ *   myfs-scan-bench -d /mnt/myfs -d /mnt/myfs-cluster [-n 64] [-f 1024]
+ *                   [-r 5] [-c 64M] [-k]
+ *
+ * Creates -n directories of -f empty files each, round-robin across the
+ * directories so their inodes interleave in creation order, then scans
+ * every directory -r times: readdir and fstatat() of each name.  Before
+ * each scan a -c sized buffer is written over to push the metadata out
+ * of the CPU caches.  The tree is removed afterwards unless -k.
+ *
+ * Reported per directory: creation time and the best and mean scan time
+ * with entries/sec for the best.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_DIRS	8
+
+static int nr_subdirs = 64;
+static int nr_files = 1024;
+static int rounds = 5;
+static int keep;
+static size_t flush_size = 64 << 20;
+static char *flush_buf;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-scan-bench -d DIR [-d DIR...] [-n DIRS] [-f FILES] [-r ROUNDS]\n"
+		"                       [-c FLUSH_SIZE] [-k]\n");
+	exit(2);
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G': v <<= 10; /* fall through */
+	case 'm': case 'M': v <<= 10; /* fall through */
+	case 'k': case 'K': v <<= 10;
+	}
+	return v;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Evict what the last scan left in the CPU caches. */
+static void flush_caches(void)
+{
+	static unsigned char pass;
+	size_t i;
+
+	pass++;
+	for (i = 0; i < flush_size; i += 64)
+		flush_buf[i] = pass;
+}
+
+static uint64_t scan(int top)
+{
+	uint64_t entries = 0;
+	char name[32];
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	int i, fd;
+
+	for (i = 0; i < nr_subdirs; i++) {
+		snprintf(name, sizeof(name), "d%d", i);
+		fd = openat(top, name, O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
+			die(name);
+		d = fdopendir(fd);
+		if (!d)
+			die("fdopendir");
+		while ((de = readdir(d))) {
+			if (de->d_name[0] == '.')
+				continue;
+			if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW))
+				die(de->d_name);
+			entries++;
+		}
+		closedir(d);
+	}
+	return entries;
+}
+
+static void remove_tree(int top, const char *path)
+{
+	char name[32];
+	int i, j, fd;
+
+	for (i = 0; i < nr_subdirs; i++) {
+		snprintf(name, sizeof(name), "d%d", i);
+		fd = openat(top, name, O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
+			continue;
+		for (j = 0; j < nr_files; j++) {
+			snprintf(name, sizeof(name), "f%d", j);
+			unlinkat(fd, name, 0);
+		}
+		close(fd);
+		snprintf(name, sizeof(name), "d%d", i);
+		unlinkat(top, name, AT_REMOVEDIR);
+	}
+	close(top);
+	rmdir(path);
+}
+
+struct result {
+	double		create_secs;
+	double		best_secs;
+	double		total_secs;
+	uint64_t	entries;
+};
+
+static struct result bench_dir(const char *dir)
+{
+	struct result res = { 0 };
+	char path[4096], name[32];
+	int *fds, top, i, j, fd;
+	double start, t;
+
+	snprintf(path, sizeof(path), "%s/myfs-scan-bench.XXXXXX", dir);
+	if (!mkdtemp(path))
+		die(path);
+	top = open(path, O_RDONLY | O_DIRECTORY);
+	if (top < 0)
+		die(path);
+
+	fds = calloc(nr_subdirs, sizeof(*fds));
+	if (!fds)
+		die("calloc");
+	start = now();
+	for (i = 0; i < nr_subdirs; i++) {
+		snprintf(name, sizeof(name), "d%d", i);
+		if (mkdirat(top, name, 0755))
+			die(name);
+		fds[i] = openat(top, name, O_RDONLY | O_DIRECTORY);
+		if (fds[i] < 0)
+			die(name);
+	}
+	/* round-robin, so the directories' inodes interleave */
+	for (j = 0; j < nr_files; j++) {
+		snprintf(name, sizeof(name), "f%d", j);
+		for (i = 0; i < nr_subdirs; i++) {
+			fd = openat(fds[i], name, O_CREAT | O_EXCL | O_WRONLY, 0644);
+			if (fd < 0)
+				die(name);
+			close(fd);
+		}
+	}
+	res.create_secs = now() - start;
+	for (i = 0; i < nr_subdirs; i++)
+		close(fds[i]);
+	free(fds);
+
+	for (i = 0; i < rounds; i++) {
+		flush_caches();
+		start = now();
+		res.entries = scan(top);
+		t = now() - start;
+		res.total_secs += t;
+		if (!i || t < res.best_secs)
+			res.best_secs = t;
+	}
+
+	if (keep) {
+		printf("kept %s\n", path);
+		close(top);
+	} else {
+		remove_tree(top, path);
+	}
+	return res;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dirs[MAX_DIRS];
+	struct result res[MAX_DIRS];
+	int nr_dirs = 0, c, i;
+
+	while ((c = getopt(argc, argv, "d:n:f:r:c:k")) != -1) {
+		switch (c) {
+		case 'd':
+			if (nr_dirs == MAX_DIRS)
+				usage();
+			dirs[nr_dirs++] = optarg;
+			break;
+		case 'n':
+			nr_subdirs = atoi(optarg);
+			break;
+		case 'f':
+			nr_files = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'c':
+			flush_size = parse_size(optarg);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!nr_dirs || nr_subdirs < 1 || nr_files < 1 || rounds < 1 || !flush_size)
+		usage();
+	flush_buf = malloc(flush_size);
+	if (!flush_buf)
+		die("malloc");
+	memset(flush_buf, 0, flush_size);
+
+	printf("%d directories of %d files, %d scans, %zu MiB cache flush\n",
+	       nr_subdirs, nr_files, rounds, flush_size >> 20);
+	printf("%-24s %10s %10s %10s %14s %10s\n", "dir", "create",
+	       "best", "mean", "entries/s", "vs_first");
+	for (i = 0; i < nr_dirs; i++) {
+		double rate;
+
+		res[i] = bench_dir(dirs[i]);
+		rate = res[i].entries / res[i].best_secs;
+		printf("%-24s %10.3f %10.4f %10.4f %14.0f %9.2fx\n",
+		       dirs[i], res[i].create_secs, res[i].best_secs,
+		       res[i].total_secs / rounds, rate,
+		       i ? rate / (res[0].entries / res[0].best_secs) : 1.0);
+	}
+	return 0;
+}
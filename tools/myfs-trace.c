@@ -0,0 +1,833 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-trace: record the operation stream of a live myfs mount from the
+ * myfs tracepoints and replay it against another mount.
+ *
+ *   myfs-trace record -m /mnt/myfs -o ops.trace [-t seconds] [-b buffer_kb]
+ *   myfs-trace replay -i ops.trace -d /mnt/target [-s speed]
+ *
+ * Replay runs one thread per recorded thread, each issuing its operations
+ * in order at the recorded offsets from the start of the trace (scaled by
+ * speed), and reports throughput and latency percentiles per operation
+ * next to the recorded latencies.  Speed 0 replays as fast as possible,
+ * which keeps each thread's order but not the order between threads.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#define TRACE_MAGIC	"#myfs-trace v1"
+#define MAX_IO		(16UL << 20)
+#define HIST_SUB	8
+#define HIST_BUCKETS	(64 * HIST_SUB)
+
+enum op {
+	OP_READ, OP_WRITE, OP_FAULT, OP_TRUNCATE,
+	OP_CREATE, OP_MKNOD, OP_MKDIR, OP_SYMLINK, OP_TMPFILE,
+	OP_LINK, OP_UNLINK, OP_RMDIR, OP_RENAME,
+	OP_NR
+};
+
+static const char *op_names[OP_NR] = {
+	"read", "write", "fault", "truncate",
+	"create", "mknod", "mkdir", "symlink", "tmpfile",
+	"link", "unlink", "rmdir", "rename",
+};
+
+struct rec {
+	int		op;
+	pid_t		tid;
+	uint64_t	ts;
+	uint64_t	lat;
+	uint64_t	ino;
+	int64_t		pos;
+	uint64_t	len;
+	uint64_t	dir;
+	uint64_t	dir2;
+	unsigned int	mode;
+	char		*name;
+	char		*name2;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-trace record -m MOUNT -o FILE [-t SECONDS] [-b BUFFER_KB]\n"
+		"       myfs-trace replay -i FILE -d DIR [-s SPEED]\n");
+	exit(2);
+}
+
+static int op_lookup(const char *s, size_t n)
+{
+	int i;
+
+	for (i = 0; i < OP_NR; i++)
+		if (strlen(op_names[i]) == n && !strncmp(op_names[i], s, n))
+			return i;
+	return -1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ---------------------------------------------------------------- record */
+
+static volatile sig_atomic_t stop_recording;
+
+static void on_signal(int sig)
+{
+	stop_recording = 1;
+}
+
+static const char *tracefs(void)
+{
+	static const char *const dirs[] = {
+		"/sys/kernel/tracing", "/sys/kernel/debug/tracing",
+	};
+	char path[256];
+	size_t i;
+
+	for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+		snprintf(path, sizeof(path), "%s/events/myfs", dirs[i]);
+		if (!access(path, F_OK))
+			return dirs[i];
+	}
+	fprintf(stderr, "myfs-trace: myfs trace events not found (module loaded, tracefs mounted?)\n");
+	exit(1);
+}
+
+static void tracefs_write(const char *dir, const char *file, const char *val)
+{
+	char path[256];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd < 0 || write(fd, val, strlen(val)) < 0)
+		die(path);
+	close(fd);
+}
+
+static const char *field(const char *line, const char *key)
+{
+	const char *p = strstr(line, key);
+
+	return p ? p + strlen(key) : NULL;
+}
+
+/* Write a name with whitespace, '%' and non-printables escaped as %XX. */
+static void put_name(FILE *out, const char *s, unsigned int len)
+{
+	unsigned int i;
+
+	if (!len) {
+		fputc('-', out);
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c <= ' ' || c >= 0x7f || c == '%' || (c == '-' && len == 1))
+			fprintf(out, "%%%02X", c);
+		else
+			fputc(c, out);
+	}
+}
+
+/*
+ * Turn one trace_pipe line into a record line:
+ *   tid ts lat op ino pos len dir dir2 mode name name2
+ */
+static void record_line(const char *line, FILE *out, const char *devstr)
+{
+	const char *ev, *p, *q;
+	unsigned int nlen = 0, nlen2 = 0;
+	const char *name = "", *name2 = "";
+	unsigned long long ino = 0, dir = 0, dir2 = 0, len = 0;
+	unsigned long long ts = 0, lat = 0;
+	long long pos = 0;
+	unsigned int mode = 0;
+	long tid;
+	int op;
+
+	ev = strstr(line, ": myfs_");
+	if (!ev)
+		return;
+	p = field(ev, "dev=");
+	if (!p || strncmp(p, devstr, strlen(devstr)) || p[strlen(devstr)] != ' ')
+		return;
+
+	/* "comm-tid [cpu] ..." : tid is the number before the last '[' */
+	q = ev;
+	while (q > line && *q != '[')
+		q--;
+	while (q > line && q[-1] == ' ')
+		q--;
+	p = q;
+	while (p > line && p[-1] != '-')
+		p--;
+	tid = strtol(p, NULL, 10);
+
+	p = field(ev, "op=");
+	if (!p)
+		return;
+	op = op_lookup(p, strcspn(p, " "));
+	if (op < 0)
+		return;
+
+	if ((p = field(ev, " ts=")))
+		ts = strtoull(p, NULL, 10);
+	/* already running when tracing was turned on, so not timed */
+	if (!ts)
+		return;
+	if ((p = field(ev, " lat=")))
+		lat = strtoull(p, NULL, 10);
+	if ((p = field(ev, " ino=")))
+		ino = strtoull(p, NULL, 10);
+
+	if (op <= OP_TRUNCATE) {
+		if ((p = field(ev, " pos=")))
+			pos = strtoll(p, NULL, 10);
+		if ((p = field(ev, " len=")))
+			len = strtoull(p, NULL, 10);
+		if ((p = field(ev, " ret=")) && strtoll(p, NULL, 10) < 0)
+			return;
+	} else {
+		if ((p = field(ev, " dir=")))
+			dir = strtoull(p, NULL, 10);
+		if ((p = field(ev, " dir2=")))
+			dir2 = strtoull(p, NULL, 10);
+		if ((p = field(ev, " mode=")))
+			mode = strtoul(p, NULL, 8);
+		if ((p = field(ev, " ret=")) && strtol(p, NULL, 10) < 0)
+			return;
+		if ((p = field(ev, " name="))) {
+			nlen = strtoul(p, (char **)&name, 10);
+			name++;
+			if ((q = strstr(name + nlen, " name2="))) {
+				nlen2 = strtoul(q + 7, (char **)&name2, 10);
+				name2++;
+			}
+		}
+	}
+
+	fprintf(out, "%ld %llu %llu %s %llu %lld %llu %llu %llu %o ",
+		tid, ts, lat, op_names[op], ino, pos, len, dir, dir2, mode);
+	put_name(out, name, nlen);
+	fputc(' ', out);
+	put_name(out, name2, nlen2);
+	fputc('\n', out);
+}
+
+static int cmd_record(int argc, char **argv)
+{
+	const char *mnt = NULL, *outfile = NULL, *bufkb = NULL;
+	char devstr[32], filter[64], path[256];
+	unsigned int seconds = 0;
+	struct sigaction sa = { .sa_handler = on_signal };
+	const char *tfs;
+	struct stat st;
+	FILE *pipe, *out;
+	char *line = NULL;
+	size_t cap = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:o:t:b:")) != -1) {
+		switch (c) {
+		case 'm': mnt = optarg; break;
+		case 'o': outfile = optarg; break;
+		case 't': seconds = atoi(optarg); break;
+		case 'b': bufkb = optarg; break;
+		default: usage();
+		}
+	}
+	if (!mnt || !outfile)
+		usage();
+	if (stat(mnt, &st))
+		die(mnt);
+
+	tfs = tracefs();
+	snprintf(devstr, sizeof(devstr), "%u:%u", major(st.st_dev), minor(st.st_dev));
+	/* the kernel's dev_t is MAJOR << 20 | MINOR */
+	snprintf(filter, sizeof(filter), "dev == %llu",
+		 ((unsigned long long)major(st.st_dev) << 20) | minor(st.st_dev));
+
+	out = fopen(outfile, "w");
+	if (!out)
+		die(outfile);
+	fprintf(out, "%s root=%llu\n", TRACE_MAGIC, (unsigned long long)st.st_ino);
+
+	if (bufkb)
+		tracefs_write(tfs, "buffer_size_kb", bufkb);
+	tracefs_write(tfs, "events/myfs/filter", filter);
+	tracefs_write(tfs, "events/myfs/enable", "1");
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGALRM, &sa, NULL);
+	if (seconds)
+		alarm(seconds);
+
+	snprintf(path, sizeof(path), "%s/trace_pipe", tfs);
+	pipe = fopen(path, "r");
+	if (!pipe)
+		die(path);
+	while (!stop_recording && getline(&line, &cap, pipe) > 0)
+		record_line(line, out, devstr);
+
+	tracefs_write(tfs, "events/myfs/enable", "0");
+	tracefs_write(tfs, "events/myfs/filter", "0");
+	free(line);
+	fclose(pipe);
+	if (fclose(out))
+		die(outfile);
+	return 0;
+}
+
+/* ---------------------------------------------------------------- replay */
+
+struct hist {
+	uint64_t	count;
+	uint64_t	errors;
+	uint64_t	max;
+	uint64_t	bucket[HIST_BUCKETS];
+};
+
+static int hist_bucket(uint64_t v)
+{
+	int msb, sub;
+
+	if (v < HIST_SUB)
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	sub = (v >> (msb - 3)) & (HIST_SUB - 1);
+	return (msb - 2) * HIST_SUB + sub;
+}
+
+static uint64_t hist_value(int b)
+{
+	int msb = b / HIST_SUB + 2, sub = b % HIST_SUB;
+
+	if (b < HIST_SUB)
+		return b;
+	return ((uint64_t)(HIST_SUB + sub + 1) << (msb - 3)) - 1;
+}
+
+static void hist_add(struct hist *h, uint64_t v)
+{
+	h->count++;
+	h->bucket[hist_bucket(v)]++;
+	if (v > h->max)
+		h->max = v;
+}
+
+static uint64_t hist_pct(const struct hist *h, double pct)
+{
+	uint64_t want = (uint64_t)(h->count * pct / 100.0), seen = 0;
+	int b;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen > want)
+			return hist_value(b) < h->max ? hist_value(b) : h->max;
+	}
+	return h->max;
+}
+
+/* inode number -> name in parent directory, and an open fd if we have one */
+struct node {
+	uint64_t	ino;
+	uint64_t	parent;
+	char		*name;
+	int		fd;
+	struct node	*next;
+};
+
+#define NODE_HASH	65536
+
+static struct node *nodes[NODE_HASH];
+static pthread_mutex_t node_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t root_ino;
+static int root_fd;
+
+static struct node *node_get(uint64_t ino, int create)
+{
+	struct node **pp = &nodes[ino % NODE_HASH], *n;
+
+	for (n = *pp; n; n = n->next)
+		if (n->ino == ino)
+			return n;
+	if (!create)
+		return NULL;
+	n = calloc(1, sizeof(*n));
+	if (!n)
+		die("calloc");
+	n->ino = ino;
+	n->fd = -1;
+	n->next = *pp;
+	*pp = n;
+	return n;
+}
+
+static void node_forget(uint64_t ino)
+{
+	struct node **pp = &nodes[ino % NODE_HASH], *n;
+
+	for (; (n = *pp); pp = &n->next) {
+		if (n->ino != ino)
+			continue;
+		*pp = n->next;
+		if (n->fd >= 0)
+			close(n->fd);
+		free(n->name);
+		free(n);
+		return;
+	}
+}
+
+/*
+ * Path of @ino relative to the replay root.  Inodes the trace never
+ * named (they existed before recording started) are materialised as
+ * ".replay/<ino>" on first use.  Called with node_lock held.
+ */
+static int node_path(uint64_t ino, char *buf, size_t size, int dir)
+{
+	char tmp[4096];
+	struct node *n;
+	int depth = 0;
+
+	if (ino == root_ino) {
+		snprintf(buf, size, ".");
+		return 0;
+	}
+	n = node_get(ino, 0);
+	if (!n || !n->name) {
+		mkdirat(root_fd, ".replay", 0755);
+		snprintf(buf, size, ".replay/%" PRIu64, ino);
+		if (dir)
+			mkdirat(root_fd, buf, 0755);
+		return 0;
+	}
+	buf[0] = 0;
+	while (n && n->name && depth++ < 256) {
+		snprintf(tmp, sizeof(tmp), "%s%s%s", n->name, buf[0] ? "/" : "", buf);
+		snprintf(buf, size, "%s", tmp);
+		if (n->parent == root_ino)
+			return 0;
+		n = node_get(n->parent, 0);
+	}
+	/* parent chain left the recorded tree */
+	snprintf(tmp, sizeof(tmp), "%s", buf);
+	snprintf(buf, size, ".replay/%.4000s", tmp);
+	mkdirat(root_fd, ".replay", 0755);
+	return 0;
+}
+
+static int node_fd(uint64_t ino)
+{
+	char path[4096];
+	struct node *n;
+	int fd;
+
+	pthread_mutex_lock(&node_lock);
+	n = node_get(ino, 1);
+	if (n->fd < 0) {
+		node_path(ino, path, sizeof(path), 0);
+		n->fd = openat(root_fd, path, O_RDWR | O_CREAT, 0644);
+	}
+	fd = n->fd;
+	pthread_mutex_unlock(&node_lock);
+	return fd;
+}
+
+static void node_name(uint64_t ino, uint64_t parent, const char *name)
+{
+	struct node *n = node_get(ino, 1);
+
+	free(n->name);
+	n->name = strdup(name);
+	n->parent = parent;
+}
+
+static char *get_name(const char *s)
+{
+	char *out, *o;
+
+	if (!strcmp(s, "-"))
+		return strdup("");
+	out = o = malloc(strlen(s) + 1);
+	if (!out)
+		die("malloc");
+	while (*s) {
+		unsigned int c;
+
+		if (*s == '%' && sscanf(s + 1, "%2x", &c) == 1) {
+			*o++ = c;
+			s += 3;
+		} else {
+			*o++ = *s++;
+		}
+	}
+	*o = 0;
+	return out;
+}
+
+struct thread {
+	pthread_t	thread;
+	pid_t		tid;
+	struct rec	*recs;
+	size_t		nr, cap;
+	struct hist	hist[OP_NR];
+	struct hist	orig[OP_NR];
+	uint64_t	bytes_read, bytes_written;
+};
+
+static struct thread *threads;
+static size_t nr_threads;
+static uint64_t trace_t0, replay_t0;
+static double speed = 1.0;
+static char *iobuf;
+
+static struct thread *thread_for(pid_t tid)
+{
+	size_t i;
+
+	for (i = 0; i < nr_threads; i++)
+		if (threads[i].tid == tid)
+			return &threads[i];
+	threads = realloc(threads, (nr_threads + 1) * sizeof(*threads));
+	if (!threads)
+		die("realloc");
+	memset(&threads[nr_threads], 0, sizeof(*threads));
+	threads[nr_threads].tid = tid;
+	return &threads[nr_threads++];
+}
+
+static int namespace_op(struct rec *r)
+{
+	char path[4096], path2[4096], parent[4096];
+	struct node *n;
+	int ret = 0, fd;
+
+	pthread_mutex_lock(&node_lock);
+	node_path(r->dir, parent, sizeof(parent), 1);
+	snprintf(path, sizeof(path), "%.3800s/%.255s", parent, r->name);
+
+	switch (r->op) {
+	case OP_CREATE:
+		fd = openat(root_fd, path, O_CREAT | O_EXCL | O_RDWR, r->mode & 07777);
+		if (fd < 0) {
+			ret = -1;
+			break;
+		}
+		node_name(r->ino, r->dir, r->name);
+		n = node_get(r->ino, 1);
+		if (n->fd >= 0)
+			close(n->fd);
+		n->fd = fd;
+		break;
+	case OP_MKNOD:
+		ret = mknodat(root_fd, path, r->mode, 0);
+		if (!ret)
+			node_name(r->ino, r->dir, r->name);
+		break;
+	case OP_MKDIR:
+		ret = mkdirat(root_fd, path, r->mode & 07777);
+		if (!ret)
+			node_name(r->ino, r->dir, r->name);
+		break;
+	case OP_SYMLINK:
+		/* the target is not traced */
+		ret = symlinkat("myfs-trace", root_fd, path);
+		if (!ret)
+			node_name(r->ino, r->dir, r->name);
+		break;
+	case OP_TMPFILE:
+		fd = openat(root_fd, parent, O_TMPFILE | O_RDWR, r->mode & 07777);
+		if (fd < 0) {
+			ret = -1;
+			break;
+		}
+		n = node_get(r->ino, 1);
+		if (n->fd >= 0)
+			close(n->fd);
+		n->fd = fd;
+		break;
+	case OP_LINK:
+		n = node_get(r->ino, 0);
+		if (n && n->fd >= 0 && !n->name) {
+			/* linking a tmpfile into the namespace */
+			snprintf(path2, sizeof(path2), "/proc/self/fd/%d", n->fd);
+			ret = linkat(AT_FDCWD, path2, root_fd, path, AT_SYMLINK_FOLLOW);
+		} else {
+			node_path(r->ino, path2, sizeof(path2), 0);
+			ret = linkat(root_fd, path2, root_fd, path, 0);
+		}
+		if (!ret && (!n || !n->name))
+			node_name(r->ino, r->dir, r->name);
+		break;
+	case OP_UNLINK:
+	case OP_RMDIR:
+		ret = unlinkat(root_fd, path, r->op == OP_RMDIR ? AT_REMOVEDIR : 0);
+		n = node_get(r->ino, 0);
+		if (!ret && n && n->parent == r->dir && n->name &&
+		    !strcmp(n->name, r->name))
+			node_forget(r->ino);
+		break;
+	case OP_RENAME:
+		node_path(r->dir2, path2, sizeof(path2), 1);
+		strncat(path2, "/", sizeof(path2) - strlen(path2) - 1);
+		strncat(path2, r->name2, sizeof(path2) - strlen(path2) - 1);
+		ret = syscall(SYS_renameat2, root_fd, path, root_fd, path2, r->mode);
+		if (!ret)
+			node_name(r->ino, r->dir2, r->name2);
+		break;
+	}
+	pthread_mutex_unlock(&node_lock);
+	return ret;
+}
+
+static int data_op(struct thread *t, struct rec *r)
+{
+	uint64_t done = 0, len = r->len;
+	ssize_t n;
+	int fd = node_fd(r->ino);
+
+	if (fd < 0)
+		return -1;
+	if (r->op == OP_TRUNCATE)
+		return ftruncate(fd, r->pos);
+
+	while (done < len) {
+		size_t chunk = len - done > MAX_IO ? MAX_IO : len - done;
+
+		if (r->op == OP_WRITE)
+			n = pwrite(fd, iobuf, chunk, r->pos + done);
+		else
+			n = pread(fd, iobuf, chunk, r->pos + done);
+		if (n < 0)
+			return -1;
+		if (r->op == OP_WRITE)
+			t->bytes_written += n;
+		else
+			t->bytes_read += n;
+		if (n < (ssize_t)chunk)
+			break;
+		done += n;
+	}
+	return 0;
+}
+
+static void *replay_thread(void *arg)
+{
+	struct thread *t = arg;
+	size_t i;
+
+	for (i = 0; i < t->nr; i++) {
+		struct rec *r = &t->recs[i];
+		uint64_t start, end;
+		int ret;
+
+		if (speed > 0) {
+			uint64_t due = replay_t0 + (uint64_t)((r->ts - trace_t0) / speed);
+			struct timespec ts = {
+				.tv_sec = due / 1000000000ULL,
+				.tv_nsec = due % 1000000000ULL,
+			};
+
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+		}
+
+		start = now_ns();
+		if (r->op <= OP_TRUNCATE)
+			ret = data_op(t, r);
+		else
+			ret = namespace_op(r);
+		end = now_ns();
+
+		hist_add(&t->hist[r->op], end - start);
+		hist_add(&t->orig[r->op], r->lat);
+		if (ret < 0)
+			t->hist[r->op].errors++;
+	}
+	return NULL;
+}
+
+static void load_trace(const char *file)
+{
+	char name[4096], name2[4096], opname[32];
+	char *line = NULL;
+	size_t cap = 0;
+	FILE *in;
+	int first = 1;
+
+	in = fopen(file, "r");
+	if (!in)
+		die(file);
+	if (getline(&line, &cap, in) <= 0 || strncmp(line, TRACE_MAGIC, strlen(TRACE_MAGIC)) ||
+	    sscanf(line + strlen(TRACE_MAGIC), " root=%" SCNu64, &root_ino) != 1) {
+		fprintf(stderr, "myfs-trace: %s is not a myfs-trace recording\n", file);
+		exit(1);
+	}
+
+	while (getline(&line, &cap, in) > 0) {
+		struct rec r = { 0 };
+		struct thread *t;
+		long tid;
+
+		if (sscanf(line, "%ld %" SCNu64 " %" SCNu64 " %31s %" SCNu64 " %" SCNd64
+			   " %" SCNu64 " %" SCNu64 " %" SCNu64 " %o %4095s %4095s",
+			   &tid, &r.ts, &r.lat, opname, &r.ino, &r.pos, &r.len,
+			   &r.dir, &r.dir2, &r.mode, name, name2) != 12)
+			continue;
+		r.op = op_lookup(opname, strlen(opname));
+		if (r.op < 0)
+			continue;
+		r.tid = tid;
+		r.name = get_name(name);
+		r.name2 = get_name(name2);
+		if (first || r.ts < trace_t0)
+			trace_t0 = r.ts;
+		first = 0;
+
+		t = thread_for(r.tid);
+		if (t->nr == t->cap) {
+			t->cap = t->cap ? t->cap * 2 : 256;
+			t->recs = realloc(t->recs, t->cap * sizeof(*t->recs));
+			if (!t->recs)
+				die("realloc");
+		}
+		t->recs[t->nr++] = r;
+	}
+	free(line);
+	fclose(in);
+}
+
+static void report(uint64_t elapsed)
+{
+	struct hist total[OP_NR] = { 0 }, orig[OP_NR] = { 0 };
+	uint64_t ops = 0, rd = 0, wr = 0;
+	double secs = elapsed / 1e9;
+	size_t i;
+	int op, b;
+
+	for (i = 0; i < nr_threads; i++) {
+		struct thread *t = &threads[i];
+
+		rd += t->bytes_read;
+		wr += t->bytes_written;
+		for (op = 0; op < OP_NR; op++) {
+			total[op].count += t->hist[op].count;
+			total[op].errors += t->hist[op].errors;
+			orig[op].count += t->orig[op].count;
+			if (t->hist[op].max > total[op].max)
+				total[op].max = t->hist[op].max;
+			if (t->orig[op].max > orig[op].max)
+				orig[op].max = t->orig[op].max;
+			for (b = 0; b < HIST_BUCKETS; b++) {
+				total[op].bucket[b] += t->hist[op].bucket[b];
+				orig[op].bucket[b] += t->orig[op].bucket[b];
+			}
+		}
+	}
+	for (op = 0; op < OP_NR; op++)
+		ops += total[op].count;
+
+	printf("threads %zu  ops %" PRIu64 "  elapsed %.3fs  %.0f ops/s  read %.1f MB/s  write %.1f MB/s\n",
+	       nr_threads, ops, secs, ops / secs, rd / secs / 1e6, wr / secs / 1e6);
+	printf("%-9s %10s %8s %10s %10s %10s %10s %10s %12s %12s\n",
+	       "op", "count", "errors", "p50_us", "p90_us", "p99_us",
+	       "p99.9_us", "max_us", "rec_p50_us", "rec_p99_us");
+	for (op = 0; op < OP_NR; op++) {
+		struct hist *h = &total[op];
+
+		if (!h->count)
+			continue;
+		printf("%-9s %10" PRIu64 " %8" PRIu64 " %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f %12.1f\n",
+		       op_names[op], h->count, h->errors,
+		       hist_pct(h, 50) / 1e3, hist_pct(h, 90) / 1e3,
+		       hist_pct(h, 99) / 1e3, hist_pct(h, 99.9) / 1e3,
+		       h->max / 1e3, hist_pct(&orig[op], 50) / 1e3,
+		       hist_pct(&orig[op], 99) / 1e3);
+	}
+}
+
+static int cmd_replay(int argc, char **argv)
+{
+	const char *infile = NULL, *dir = NULL;
+	uint64_t end;
+	size_t i;
+	int c;
+
+	while ((c = getopt(argc, argv, "i:d:s:")) != -1) {
+		switch (c) {
+		case 'i': infile = optarg; break;
+		case 'd': dir = optarg; break;
+		case 's': speed = atof(optarg); break;
+		default: usage();
+		}
+	}
+	if (!infile || !dir)
+		usage();
+
+	root_fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (root_fd < 0)
+		die(dir);
+	iobuf = malloc(MAX_IO);
+	if (!iobuf)
+		die("malloc");
+	memset(iobuf, 0xa5, MAX_IO);
+
+	load_trace(infile);
+	if (!nr_threads) {
+		fprintf(stderr, "myfs-trace: %s has no operations\n", infile);
+		return 1;
+	}
+
+	replay_t0 = now_ns();
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i].thread, NULL, replay_thread, &threads[i]))
+			die("pthread_create");
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	end = now_ns();
+
+	report(end - replay_t0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		usage();
+	if (!strcmp(argv[1], "record"))
+		return cmd_record(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "replay"))
+		return cmd_replay(argc - 1, argv + 1);
+	usage();
+	return 2;
+}
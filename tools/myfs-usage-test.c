@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * myfs-usage-test: checks the per-uid "usage" debugfs file of a myfs
+ * mount against files of known owners and sizes.  Needs root, for
+ * fchown() and debugfs.
+ *
+ *   myfs-usage-test -d /mnt/myfs [-D /sys/kernel/debug] [-u 60000]
+ *                   [-U 4] [-n 16]
+ *
+ * Reads the mount's usage file, then creates -n files for each of -U
+ * owners starting at uid -u, file i of each owner holding i * 1000 + 1
+ * bytes.  Reads the usage file again and checks that every owner's
+ * inode, byte and page counts grew by exactly what was created.  Then
+ * removes the files and checks the owners are gone again.  Exits 0 on
+ * success, 1 on a mismatch.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#define MAX_UIDS	64
+
+struct usage {
+	uint64_t	inodes;
+	uint64_t	bytes;
+	uint64_t	pages;
+};
+
+static const char *debugfs = "/sys/kernel/debug";
+static unsigned int base_uid = 60000;
+static int nr_uids = 4;
+static int nr_files = 16;
+static long page_size;
+static char usage_path[4096];
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: myfs-usage-test -d DIR [-D DEBUGFS] [-u BASE_UID] [-U UIDS]\n"
+		"                       [-n FILES_PER_UID]\n");
+	exit(2);
+}
+
+/* The test owners' lines of the usage file; other owners are ignored. */
+static void read_usage(struct usage *u)
+{
+	char line[256];
+	unsigned int uid;
+	struct usage v;
+	FILE *f = fopen(usage_path, "r");
+
+	if (!f)
+		die(usage_path);
+	memset(u, 0, nr_uids * sizeof(*u));
+	if (!fgets(line, sizeof(line), f)) {
+		fprintf(stderr, "%s: empty\n", usage_path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "other", 5)) {
+			fprintf(stderr, "%s: too many owners on the mount\n",
+				usage_path);
+			exit(1);
+		}
+		if (sscanf(line, "%u %" SCNu64 " %" SCNu64 " %" SCNu64, &uid,
+			   &v.inodes, &v.bytes, &v.pages) != 4) {
+			fprintf(stderr, "%s: bad line: %s", usage_path, line);
+			exit(1);
+		}
+		if (uid >= base_uid && uid < base_uid + nr_uids)
+			u[uid - base_uid] = v;
+	}
+	fclose(f);
+}
+
+static int check(const char *phase, const struct usage *before,
+		 const struct usage *after, const struct usage *want)
+{
+	int i, bad = 0;
+
+	for (i = 0; i < nr_uids; i++) {
+		struct usage got = {
+			.inodes	= after[i].inodes - before[i].inodes,
+			.bytes	= after[i].bytes - before[i].bytes,
+			.pages	= after[i].pages - before[i].pages,
+		};
+
+		if (!memcmp(&got, &want[i], sizeof(got)))
+			continue;
+		fprintf(stderr, "%s: uid %u: inodes %" PRIu64 " bytes %" PRIu64
+			" pages %" PRIu64 ", want %" PRIu64 " %" PRIu64 " %" PRIu64
+			"\n", phase, base_uid + i, got.inodes, got.bytes,
+			got.pages, want[i].inodes, want[i].bytes, want[i].pages);
+		bad = 1;
+	}
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	struct usage before[MAX_UIDS], after[MAX_UIDS], want[MAX_UIDS];
+	const char *dir = NULL;
+	char path[4096], *buf;
+	struct stat st;
+	int i, j, c, fd, bad;
+	size_t len;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	while ((c = getopt(argc, argv, "d:D:u:U:n:")) != -1) {
+		switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'D':
+			debugfs = optarg;
+			break;
+		case 'u':
+			base_uid = strtoul(optarg, NULL, 0);
+			break;
+		case 'U':
+			nr_uids = atoi(optarg);
+			break;
+		case 'n':
+			nr_files = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!dir || nr_uids < 1 || nr_uids > MAX_UIDS || nr_files < 1)
+		usage();
+
+	if (stat(dir, &st))
+		die(dir);
+	snprintf(usage_path, sizeof(usage_path), "%s/myfs/%u:%u/usage",
+		 debugfs, major(st.st_dev), minor(st.st_dev));
+
+	buf = malloc((size_t)(nr_files - 1) * 1000 + 1);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, (size_t)(nr_files - 1) * 1000 + 1);
+
+	read_usage(before);
+	memset(want, 0, sizeof(want));
+	for (i = 0; i < nr_uids; i++)
+		for (j = 0; j < nr_files; j++) {
+			snprintf(path, sizeof(path), "%s/myfs-usage-test.%d.%d",
+				 dir, i, j);
+			fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0600);
+			if (fd < 0)
+				die(path);
+			len = (size_t)j * 1000 + 1;
+			if (write(fd, buf, len) != (ssize_t)len)
+				die("write");
+			if (fchown(fd, base_uid + i, -1))
+				die("fchown");
+			close(fd);
+			want[i].inodes++;
+			want[i].bytes += len;
+			want[i].pages += (len + page_size - 1) / page_size;
+		}
+	read_usage(after);
+	bad = check("created", before, after, want);
+
+	for (i = 0; i < nr_uids; i++)
+		for (j = 0; j < nr_files; j++) {
+			snprintf(path, sizeof(path), "%s/myfs-usage-test.%d.%d",
+				 dir, i, j);
+			if (unlink(path))
+				die(path);
+		}
+	/* evicted on the last iput, so the owners' counts are back */
+	memset(want, 0, sizeof(want));
+	read_usage(after);
+	bad |= check("removed", before, after, want);
+
+	free(buf);
+	printf("%s: %d owners, %d files each\n", bad ? "FAIL" : "PASS",
+	       nr_uids, nr_files);
+	return bad;
+}